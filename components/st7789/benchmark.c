@@ -0,0 +1,178 @@
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "st7789.h"
+#include "displaylist.h"
+#include "benchmark.h"
+
+#define TAG "BENCH"
+#define TRIG_LOOPS 1000
+
+typedef void (*BENCH_FUNC_t)(TFT_t * dev, FontxFile *fx);
+
+static void benchPixels(TFT_t * dev, FontxFile *fx) {
+	for(int i=0;i<100;i++) {
+		lcdDrawPixel(dev, i, i, RED);
+	}
+}
+
+static void benchLine(TFT_t * dev, FontxFile *fx) {
+	lcdDrawLine(dev, 0, 0, dev->_width-1, dev->_height-1, BLUE);
+}
+
+static void benchCircle(TFT_t * dev, FontxFile *fx) {
+	lcdDrawCircle(dev, dev->_width/2, dev->_height/2, dev->_width/3, GREEN);
+}
+
+static void benchString(TFT_t * dev, FontxFile *fx) {
+	lcdDrawString(dev, fx, 0, dev->_height/2, (uint8_t *)"Scanning WiFi...", BLACK);
+}
+
+static void benchFillRect(TFT_t * dev, FontxFile *fx) {
+	lcdDrawFillRect(dev, 10, 10, 40, 40, PURPLE);
+}
+
+static void benchScreen(TFT_t * dev, FontxFile *fx) {
+	lcdFillScreen(dev, WHITE);
+}
+
+// Record a menu frame with the usual overdraw of a UI:
+// background under the header, row backgrounds in pieces, a status bar drawn twice
+static void benchRecordMenu(DISPLAY_LIST_t * dl, TFT_t * dev, FontxFile *fx) {
+	static const char *items[] = {"HomeNet", "Cafe WiFi", "xfinity", "Office"};
+	uint8_t fw, fh;
+	GetFontx(fx, 0, &fw, &fh);
+	uint16_t w = dev->_width;
+	uint16_t h = dev->_height;
+
+	dlBegin(dl, dev);
+	dlFillScreen(dl, WHITE);
+	dlDrawFillRect(dl, 0, 0, w-1, fh+3, BLUE);
+	dlDrawString(dl, fx, 2, fh+1, (uint8_t *)"Networks", WHITE);
+	for(int i=0;i<4;i++) {
+		uint16_t y = (fh+4) * (i+1) + 4;
+		dlDrawFillRect(dl, 0, y, fh-1, y+fh+1, GRAY);
+		dlDrawFillRect(dl, fh, y, w-1, y+fh+1, GRAY);
+		if (i == 1) dlDrawFillTriangle(dl, fh/2, y+fh/2, fh-4, fh-4, 90, RED);
+		dlDrawString(dl, fx, fh, y+fh, (uint8_t *)items[i], BLACK);
+	}
+	dlDrawFillRect(dl, 0, h-fh-4, w-1, h-1, BLACK);
+	dlDrawFillRect(dl, 0, h-fh-4, w-1, h-1, GREEN);
+	dlDrawString(dl, fx, 2, h-3, (uint8_t *)"Connected", BLACK);
+}
+
+// Menu frame drawn in the recorded order
+static void benchMenu(TFT_t * dev, FontxFile *fx) {
+	static DISPLAY_LIST_t dl;
+	benchRecordMenu(&dl, dev, fx);
+	dlExecute(dev, &dl);
+}
+
+// Menu frame drawn after display list optimization
+static void benchMenuList(TFT_t * dev, FontxFile *fx) {
+	static DISPLAY_LIST_t dl;
+	benchRecordMenu(&dl, dev, fx);
+	dlDraw(dev, &dl);
+}
+
+// Run one primitive and log time, transactions and bytes
+static void benchRun(TFT_t * dev, FontxFile *fx, const char *name, const char *mode, BENCH_FUNC_t func) {
+	lcdFillScreen(dev, WHITE);
+	lcdDrawFinish(dev);
+	lcdWaitFinish(dev);
+
+	uint32_t trans = dev->_trans_count;
+	uint32_t bytes = dev->_byte_count;
+	int64_t start = esp_timer_get_time();
+	func(dev, fx);
+	lcdDrawFinish(dev);
+	lcdWaitFinish(dev);
+	int64_t elapsed = esp_timer_get_time() - start;
+	ESP_LOGI(TAG, "%-10s %-9s %8"PRId64" us %6"PRIu32" trans %7"PRIu32" bytes",
+		name, mode, elapsed, dev->_trans_count - trans, dev->_byte_count - bytes);
+}
+
+// Vertices of a rotated triangle with double math
+static void trigDouble(int xc, int yc, int w, int h, int angle, POINT_t *p) {
+	double rd = -angle * M_PI / 180.0;
+	double xd[3] = {0.0, w/2, 0.0 - w/2};
+	double yd[3] = {h/2, 0.0 - h/2, 0.0 - h/2};
+	for(int i=0;i<3;i++) {
+		p[i].x = (int)(xd[i] * cos(rd) - yd[i] * sin(rd) + xc);
+		p[i].y = (int)(xd[i] * sin(rd) + yd[i] * cos(rd) + yc);
+	}
+}
+
+// Vertices of a rotated triangle with the Q15 table
+static void trigFixed(int xc, int yc, int w, int h, int angle, POINT_t *p) {
+	uint16_t a = (angle * ANGLE_STEPS + 180) / 360;
+	int32_t s = lcdSinQ15(a);
+	int32_t c = lcdCosQ15(a);
+	int xd[3] = {0, w/2, -(w/2)};
+	int yd[3] = {h/2, -(h/2), -(h/2)};
+	for(int i=0;i<3;i++) {
+		p[i].x = ((xd[i] * c + yd[i] * s + (1 << 14)) >> 15) + xc;
+		p[i].y = ((yd[i] * c - xd[i] * s + (1 << 14)) >> 15) + yc;
+	}
+}
+
+// Compare the vertex math of the rotated primitives
+// Not yet measured on a board, so the Q15 table has no speed figures
+// behind it. On the host it is only checked for accuracy against libm.
+static void benchTrig(void) {
+	static const struct {
+		const char *mode;
+		void (*func)(int xc, int yc, int w, int h, int angle, POINT_t *p);
+	} modes[] = {
+		{"double", trigDouble},
+		{"q15", trigFixed},
+	};
+	POINT_t p[3];
+	volatile int sink = 0;
+
+	for(int m=0;m<sizeof(modes)/sizeof(modes[0]);m++) {
+		int64_t start = esp_timer_get_time();
+		for(int i=0;i<TRIG_LOOPS;i++) {
+			modes[m].func(60, 100, 12, 12, i % 360, p);
+			sink += p[0].x + p[1].y + p[2].x;
+		}
+		int64_t elapsed = esp_timer_get_time() - start;
+		ESP_LOGI(TAG, "%-10s %-9s %8"PRId64" us for %d triangles", "trig", modes[m].mode, elapsed, TRIG_LOOPS);
+	}
+	(void)sink;
+}
+
+// Compare the transfer modes of the driver primitive by primitive
+// interrupt: every transaction is queued and completed by interrupt
+// polling  : short transactions inside a batch are polled
+// Not yet measured on a board: the polling fast path has no timings behind
+// it. The host build only shows that both modes send the same transactions.
+void lcdBenchmark(TFT_t * dev, FontxFile *fx) {
+	static const struct {
+		const char *name;
+		BENCH_FUNC_t func;
+	} benches[] = {
+		{"pixel x100", benchPixels},
+		{"line", benchLine},
+		{"circle", benchCircle},
+		{"string", benchString},
+		{"fillrect", benchFillRect},
+		{"screen", benchScreen},
+		{"menu", benchMenu},
+		{"menu list", benchMenuList},
+	};
+
+	uint16_t threshold = dev->_polling_threshold;
+	for(int i=0;i<sizeof(benches)/sizeof(benches[0]);i++) {
+		dev->_polling_threshold = 0;
+		benchRun(dev, fx, benches[i].name, "interrupt", benches[i].func);
+		dev->_polling_threshold = threshold;
+		benchRun(dev, fx, benches[i].name, "polling", benches[i].func);
+	}
+	benchTrig();
+}
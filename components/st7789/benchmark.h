@@ -0,0 +1,8 @@
+#ifndef MAIN_BENCHMARK_H_
+#define MAIN_BENCHMARK_H_
+
+#include "st7789.h"
+
+void lcdBenchmark(TFT_t * dev, FontxFile *fx);
+#endif /* MAIN_BENCHMARK_H_ */
+
@@ -0,0 +1,434 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "st7789.h"
+#include "displaylist.h"
+
+#define TAG "DISPLAYLIST"
+
+// Start recording a new frame
+// dev:Display the frame will be drawn on
+void dlBegin(DISPLAY_LIST_t * dl, TFT_t * dev) {
+	dl->count = 0;
+	dl->width = dev->_width;
+	dl->height = dev->_height;
+	dl->optimized = false;
+	dl->overflow = false;
+	dl->text_used = 0;
+	dl->font_direction = 0;
+	dl->font_fill = false;
+	dl->font_underline = false;
+}
+
+// Append an op touching x1..x2, y1..y2
+// Returns NULL when the op is off screen or the list is full.
+static DL_OP_t * dlAdd(DISPLAY_LIST_t * dl, uint8_t type, int x1, int y1, int x2, int y2, uint16_t color) {
+	if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+	if (y1 > y2) { int t = y1; y1 = y2; y2 = t; }
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 >= dl->width) x2 = dl->width-1;
+	if (y2 >= dl->height) y2 = dl->height-1;
+	if (x1 > x2 || y1 > y2) return NULL;
+
+	if (dl->count >= DL_MAX_OPS) {
+		if (!dl->overflow) ESP_LOGW(TAG, "display list full, ops dropped");
+		dl->overflow = true;
+		return NULL;
+	}
+	DL_OP_t *op = &dl->ops[dl->count++];
+	op->type = type;
+	op->font_direction = dl->font_direction;
+	op->font_fill = dl->font_fill;
+	op->font_fill_color = dl->font_fill_color;
+	op->font_underline = dl->font_underline;
+	op->font_underline_color = dl->font_underline_color;
+	op->color = color;
+	op->x1 = x1;
+	op->y1 = y1;
+	op->x2 = x2;
+	op->y2 = y2;
+	dl->optimized = false;
+	return op;
+}
+
+// Append a recorded op, e.g. one taken from another list
+// text:String of a DL_STRING op
+// Returns false when the list has no room for it.
+bool dlAppend(DISPLAY_LIST_t * dl, const DL_OP_t *op, const char *text) {
+	if (dl->count >= DL_MAX_OPS) return false;
+	size_t length = 0;
+	if (op->type == DL_STRING) {
+		length = strlen(text) + 1;
+		if (dl->text_used + length > DL_TEXT_SIZE) return false;
+	}
+
+	DL_OP_t *dst = &dl->ops[dl->count++];
+	*dst = *op;
+	if (op->type == DL_STRING) {
+		dst->string.text = dl->text_used;
+		memcpy(&dl->text[dl->text_used], text, length);
+		dl->text_used += length;
+	}
+	dl->optimized = false;
+	return true;
+}
+
+// Record screen fill
+void dlFillScreen(DISPLAY_LIST_t * dl, uint16_t color) {
+	dlAdd(dl, DL_FILL_RECT, 0, 0, dl->width-1, dl->height-1, color);
+}
+
+// Record rectangle filling
+void dlDrawFillRect(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	dlAdd(dl, DL_FILL_RECT, x1, y1, x2, y2, color);
+}
+
+// Record line drawing
+void dlDrawLine(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	DL_OP_t *op = dlAdd(dl, DL_LINE, x1, y1, x2, y2, color);
+	if (op == NULL) return;
+	op->line.x1 = x1;
+	op->line.y1 = y1;
+	op->line.x2 = x2;
+	op->line.y2 = y2;
+}
+
+// Record rectangle drawing
+void dlDrawRect(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	DL_OP_t *op = dlAdd(dl, DL_RECT, x1, y1, x2, y2, color);
+	if (op == NULL) return;
+	op->line.x1 = x1;
+	op->line.y1 = y1;
+	op->line.x2 = x2;
+	op->line.y2 = y2;
+}
+
+// Record filled triangle drawing
+// The rotated vertices stay within (w+h)/2 of the center.
+void dlDrawFillTriangle(DISPLAY_LIST_t * dl, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
+	int r = (w+h)/2 + 1;
+	DL_OP_t *op = dlAdd(dl, DL_FILL_TRIANGLE, xc-r, yc-r, xc+r, yc+r, color);
+	if (op == NULL) return;
+	op->triangle.xc = xc;
+	op->triangle.yc = yc;
+	op->triangle.w = w;
+	op->triangle.h = h;
+	op->triangle.angle = angle;
+}
+
+// Record string drawing with the current font settings of the list
+void dlDrawString(DISPLAY_LIST_t * dl, FontxFile *fx, uint16_t x, uint16_t y, uint8_t * ascii, uint16_t color) {
+	uint8_t pw, ph;
+	if (!GetFontxSize(fx, &pw, &ph)) return;
+	int length = strlen((char *)ascii);
+	if (length == 0) return;
+	if (dl->text_used + length + 1 > DL_TEXT_SIZE) {
+		if (!dl->overflow) ESP_LOGW(TAG, "display list text full, ops dropped");
+		dl->overflow = true;
+		return;
+	}
+
+	// Area covered by the glyphs, see lcdDrawChar
+	int len = length * pw;
+	int x1 = x, y1 = y, x2 = x, y2 = y;
+	if (dl->font_direction == 0) {
+		x2 = x + len - 1;
+		y1 = y - (ph-1);
+	} else if (dl->font_direction == 1) {
+		x2 = x + ph;
+		y2 = y + len - 1;
+	} else if (dl->font_direction == 2) {
+		x1 = x - (len-1);
+		y2 = y + ph + 1;
+	} else if (dl->font_direction == 3) {
+		x1 = x - (ph-1);
+		y1 = y - (len-1);
+	}
+
+	DL_OP_t *op = dlAdd(dl, DL_STRING, x1, y1, x2, y2, color);
+	if (op == NULL) return;
+	op->string.fx = fx;
+	op->string.x = x;
+	op->string.y = y;
+	op->string.text = dl->text_used;
+	memcpy(&dl->text[dl->text_used], ascii, length + 1);
+	dl->text_used += length + 1;
+}
+
+// Record RGB565 image drawing
+// The image must stay valid until the list is executed.
+void dlBlit(DISPLAY_LIST_t * dl, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h) {
+	if (w == 0 || h == 0) return;
+	DL_OP_t *op = dlAdd(dl, DL_BLIT, x, y, x+w-1, y+h-1, 0);
+	if (op == NULL) return;
+	op->blit.image = image;
+	op->blit.x = x;
+	op->blit.y = y;
+	op->blit.stride = stride;
+	op->blit.sx = sx;
+	op->blit.sy = sy;
+	op->blit.w = w;
+	op->blit.h = h;
+}
+
+// Record RGB565 image drawing with transparent color
+void dlBlitKey(DISPLAY_LIST_t * dl, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h, uint16_t key) {
+	if (w == 0 || h == 0) return;
+	DL_OP_t *op = dlAdd(dl, DL_BLIT_KEY, x, y, x+w-1, y+h-1, key);
+	if (op == NULL) return;
+	op->blit.image = image;
+	op->blit.x = x;
+	op->blit.y = y;
+	op->blit.stride = stride;
+	op->blit.sx = sx;
+	op->blit.sy = sy;
+	op->blit.w = w;
+	op->blit.h = h;
+}
+
+// Set font direction for the following strings
+void dlSetFontDirection(DISPLAY_LIST_t * dl, uint16_t dir) {
+	dl->font_direction = dir;
+}
+
+// Set font filling for the following strings
+void dlSetFontFill(DISPLAY_LIST_t * dl, uint16_t color) {
+	dl->font_fill = true;
+	dl->font_fill_color = color;
+}
+
+// UnSet font filling
+void dlUnsetFontFill(DISPLAY_LIST_t * dl) {
+	dl->font_fill = false;
+}
+
+// Set font underline for the following strings
+void dlSetFontUnderLine(DISPLAY_LIST_t * dl, uint16_t color) {
+	dl->font_underline = true;
+	dl->font_underline_color = color;
+}
+
+// UnSet font underline
+void dlUnsetFontUnderLine(DISPLAY_LIST_t * dl) {
+	dl->font_underline = false;
+}
+
+static bool dlOverlap(const DL_OP_t *a, const DL_OP_t *b) {
+	return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+// True when a covers all of b
+static bool dlContains(const DL_OP_t *a, const DL_OP_t *b) {
+	return a->x1 <= b->x1 && a->x2 >= b->x2 && a->y1 <= b->y1 && a->y2 >= b->y2;
+}
+
+// True when any live op between first and last touches op
+static bool dlOverlapBetween(DISPLAY_LIST_t * dl, int first, int last, const DL_OP_t *op) {
+	for (int k=first+1;k<last;k++) {
+		if (dl->ops[k].type != DL_NOP && dlOverlap(&dl->ops[k], op)) return true;
+	}
+	return false;
+}
+
+// Drop ops that a later fill paints over completely and trim
+// fills whose top, bottom, left or right part is painted over.
+static void dlRemoveOverdraw(DISPLAY_LIST_t * dl) {
+	for (int i=0;i<dl->count;i++) {
+		DL_OP_t *op = &dl->ops[i];
+		for (int j=i+1;j<dl->count && op->type != DL_NOP;j++) {
+			DL_OP_t *fill = &dl->ops[j];
+			if (fill->type != DL_FILL_RECT) continue;
+			if (dlContains(fill, op)) {
+				op->type = DL_NOP;
+				break;
+			}
+			if (op->type != DL_FILL_RECT || !dlOverlap(fill, op)) continue;
+			if (fill->x1 <= op->x1 && fill->x2 >= op->x2) {
+				if (fill->y1 <= op->y1) op->y1 = fill->y2 + 1;
+				else if (fill->y2 >= op->y2) op->y2 = fill->y1 - 1;
+			} else if (fill->y1 <= op->y1 && fill->y2 >= op->y2) {
+				if (fill->x1 <= op->x1) op->x1 = fill->x2 + 1;
+				else if (fill->x2 >= op->x2) op->x2 = fill->x1 - 1;
+			}
+			if (op->x1 > op->x2 || op->y1 > op->y2) op->type = DL_NOP;
+		}
+	}
+}
+
+// Merge fills of the same color whose union is a rectangle.
+// The merged fill takes the place of the first or the second one,
+// whichever has no op in between drawing over it.
+static void dlMergeFills(DISPLAY_LIST_t * dl) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i=0;i<dl->count;i++) {
+			DL_OP_t *a = &dl->ops[i];
+			if (a->type != DL_FILL_RECT) continue;
+			for (int j=i+1;j<dl->count;j++) {
+				DL_OP_t *b = &dl->ops[j];
+				if (b->type != DL_FILL_RECT || b->color != a->color) continue;
+				bool column = a->x1 == b->x1 && a->x2 == b->x2 && a->y1 <= b->y2+1 && b->y1 <= a->y2+1;
+				bool row = a->y1 == b->y1 && a->y2 == b->y2 && a->x1 <= b->x2+1 && b->x1 <= a->x2+1;
+				if (!column && !row) continue;
+
+				DL_OP_t *keep, *drop;
+				if (!dlOverlapBetween(dl, i, j, b)) {
+					keep = a;
+					drop = b;
+				} else if (!dlOverlapBetween(dl, i, j, a)) {
+					keep = b;
+					drop = a;
+				} else {
+					continue;
+				}
+				if (a->x1 < keep->x1) keep->x1 = a->x1;
+				if (b->x1 < keep->x1) keep->x1 = b->x1;
+				if (a->y1 < keep->y1) keep->y1 = a->y1;
+				if (b->y1 < keep->y1) keep->y1 = b->y1;
+				if (a->x2 > keep->x2) keep->x2 = a->x2;
+				if (b->x2 > keep->x2) keep->x2 = b->x2;
+				if (a->y2 > keep->y2) keep->y2 = a->y2;
+				if (b->y2 > keep->y2) keep->y2 = b->y2;
+				drop->type = DL_NOP;
+				changed = true;
+				if (a->type == DL_NOP) break;
+			}
+		}
+	}
+}
+
+// Reorder ops top to bottom so that consecutive windows share rows.
+// An op is only moved ahead of earlier ops it does not overlap.
+// The order is chosen on indexes and applied in place, so only a few
+// bytes per op are needed on the stack.
+static void dlSortWindows(DISPLAY_LIST_t * dl) {
+	DL_OP_t *ops = dl->ops;
+	uint8_t order[DL_MAX_OPS];
+	bool done[DL_MAX_OPS];
+	int n = 0;
+	for (int i=0;i<dl->count;i++) {
+		if (ops[i].type == DL_NOP) continue;
+		ops[n] = ops[i];
+		done[n] = false;
+		n++;
+	}
+	dl->count = n;
+
+	int y1 = -1, y2 = -1;
+	for (int count=0;count<n;count++) {
+		int best = -1;
+		int best_key = 0;
+		for (int c=0;c<n;c++) {
+			if (done[c]) continue;
+			bool ready = true;
+			for (int k=0;k<c && ready;k++) {
+				if (!done[k] && dlOverlap(&ops[k], &ops[c])) ready = false;
+			}
+			if (!ready) continue;
+			// Same rows as the last window first, then top to bottom, left to right
+			bool same = ops[c].y1 == y1 && ops[c].y2 == y2;
+			int key = ((same ? 0 : 1 + ops[c].y1) << 9) + ops[c].x1;
+			if (best < 0 || key < best_key) {
+				best = c;
+				best_key = key;
+			}
+		}
+		order[count] = best;
+		done[best] = true;
+		y1 = ops[best].y1;
+		y2 = ops[best].y2;
+	}
+
+	// Move the ops along each cycle of the order, ops[i] = old ops[order[i]]
+	for (int i=0;i<n;i++) done[i] = false;
+	for (int i=0;i<n;i++) {
+		if (done[i]) continue;
+		DL_OP_t first = ops[i];
+		int j = i;
+		while (order[j] != i) {
+			ops[j] = ops[order[j]];
+			done[j] = true;
+			j = order[j];
+		}
+		ops[j] = first;
+		done[j] = true;
+	}
+}
+
+// Rewrite the list into an equivalent list that is cheaper to send
+// Overdrawn ops are removed, adjacent fills are merged and the
+// remaining ops are sorted to reuse address windows.
+void dlOptimize(TFT_t * dev, DISPLAY_LIST_t * dl) {
+	if (dl->optimized) return;
+	uint16_t count = dl->count;
+	dlRemoveOverdraw(dl);
+	dlMergeFills(dl);
+	dlSortWindows(dl);
+	dl->optimized = true;
+	ESP_LOGD(TAG, "optimized %"PRIu16" ops to %"PRIu16, count, dl->count);
+}
+
+// Draw the recorded ops in list order
+// Ops outside the current band are skipped.
+void dlExecute(TFT_t * dev, DISPLAY_LIST_t * dl) {
+	uint16_t direction = dev->_font_direction;
+	uint16_t fill = dev->_font_fill;
+	uint16_t fill_color = dev->_font_fill_color;
+	uint16_t underline = dev->_font_underline;
+	uint16_t underline_color = dev->_font_underline_color;
+
+	lcdBeginBatch(dev);
+	for (int i=0;i<dl->count;i++) {
+		DL_OP_t *op = &dl->ops[i];
+		if (op->y2 < dev->_band_y || op->y1 >= dev->_band_y + dev->_band_height) continue;
+		switch (op->type) {
+		case DL_FILL_RECT:
+			lcdDrawFillRect(dev, op->x1, op->y1, op->x2, op->y2, op->color);
+			break;
+		case DL_LINE:
+			lcdDrawLine(dev, op->line.x1, op->line.y1, op->line.x2, op->line.y2, op->color);
+			break;
+		case DL_RECT:
+			lcdDrawRect(dev, op->line.x1, op->line.y1, op->line.x2, op->line.y2, op->color);
+			break;
+		case DL_FILL_TRIANGLE:
+			lcdDrawFillTriangle(dev, op->triangle.xc, op->triangle.yc, op->triangle.w, op->triangle.h, op->triangle.angle, op->color);
+			break;
+		case DL_STRING:
+			dev->_font_direction = op->font_direction;
+			dev->_font_fill = op->font_fill;
+			dev->_font_fill_color = op->font_fill_color;
+			dev->_font_underline = op->font_underline;
+			dev->_font_underline_color = op->font_underline_color;
+			lcdDrawString(dev, op->string.fx, op->string.x, op->string.y, (uint8_t *)&dl->text[op->string.text], op->color);
+			break;
+		case DL_BLIT:
+			lcdBlit(dev, op->blit.x, op->blit.y, op->blit.image, op->blit.stride, op->blit.sx, op->blit.sy, op->blit.w, op->blit.h);
+			break;
+		case DL_BLIT_KEY:
+			lcdBlitKey(dev, op->blit.x, op->blit.y, op->blit.image, op->blit.stride, op->blit.sx, op->blit.sy, op->blit.w, op->blit.h, op->color);
+			break;
+		default:
+			break;
+		}
+	}
+	lcdEndBatch(dev);
+
+	dev->_font_direction = direction;
+	dev->_font_fill = fill;
+	dev->_font_fill_color = fill_color;
+	dev->_font_underline = underline;
+	dev->_font_underline_color = underline_color;
+}
+
+// Optimize and draw a display list
+// Matches DRAW_FUNC_t so a list can be passed to lcdDrawBands.
+void dlDraw(TFT_t * dev, void * list) {
+	DISPLAY_LIST_t *dl = list;
+	dlOptimize(dev, dl);
+	dlExecute(dev, dl);
+}
@@ -0,0 +1,89 @@
+#ifndef MAIN_DISPLAYLIST_H_
+#define MAIN_DISPLAYLIST_H_
+
+#include "st7789.h"
+
+// Capacity of one display list
+#define DL_MAX_OPS 64
+#define DL_TEXT_SIZE 512 // bytes of string storage
+
+typedef enum {
+	DL_NOP,
+	DL_FILL_RECT,
+	DL_LINE,
+	DL_RECT,
+	DL_FILL_TRIANGLE,
+	DL_STRING,
+	DL_BLIT,
+	DL_BLIT_KEY,
+} DL_OP_TYPE_t;
+
+// One recorded draw call.
+// x1..y2 is the area the op may touch, in screen coordinates.
+typedef struct {
+	uint8_t type;
+	uint8_t font_direction;
+	bool font_fill;
+	bool font_underline;
+	uint16_t font_fill_color;
+	uint16_t font_underline_color;
+	uint16_t color;
+	int16_t x1;
+	int16_t y1;
+	int16_t x2;
+	int16_t y2;
+	union {
+		struct {
+			int16_t x1, y1, x2, y2;
+		} line;
+		struct {
+			uint16_t xc, yc, w, h, angle;
+		} triangle;
+		struct {
+			FontxFile *fx;
+			uint16_t x, y;
+			uint16_t text;	// offset in the text pool
+		} string;
+		struct {
+			const uint16_t *image;
+			int16_t x, y;
+			uint16_t stride, sx, sy, w, h;
+		} blit;
+	};
+} DL_OP_t;
+
+typedef struct {
+	DL_OP_t ops[DL_MAX_OPS];
+	uint16_t count;
+	uint16_t width;
+	uint16_t height;
+	bool optimized;
+	bool overflow;
+	char text[DL_TEXT_SIZE];
+	uint16_t text_used;
+	uint16_t font_direction;
+	bool font_fill;
+	uint16_t font_fill_color;
+	bool font_underline;
+	uint16_t font_underline_color;
+} DISPLAY_LIST_t;
+
+void dlBegin(DISPLAY_LIST_t * dl, TFT_t * dev);
+bool dlAppend(DISPLAY_LIST_t * dl, const DL_OP_t *op, const char *text);
+void dlFillScreen(DISPLAY_LIST_t * dl, uint16_t color);
+void dlDrawFillRect(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
+void dlDrawLine(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
+void dlDrawRect(DISPLAY_LIST_t * dl, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
+void dlDrawFillTriangle(DISPLAY_LIST_t * dl, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color);
+void dlDrawString(DISPLAY_LIST_t * dl, FontxFile *fx, uint16_t x, uint16_t y, uint8_t * ascii, uint16_t color);
+void dlBlit(DISPLAY_LIST_t * dl, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h);
+void dlBlitKey(DISPLAY_LIST_t * dl, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h, uint16_t key);
+void dlSetFontDirection(DISPLAY_LIST_t * dl, uint16_t dir);
+void dlSetFontFill(DISPLAY_LIST_t * dl, uint16_t color);
+void dlUnsetFontFill(DISPLAY_LIST_t * dl);
+void dlSetFontUnderLine(DISPLAY_LIST_t * dl, uint16_t color);
+void dlUnsetFontUnderLine(DISPLAY_LIST_t * dl);
+void dlOptimize(TFT_t * dev, DISPLAY_LIST_t * dl);
+void dlExecute(TFT_t * dev, DISPLAY_LIST_t * dl);
+void dlDraw(TFT_t * dev, void * list);
+#endif /* MAIN_DISPLAYLIST_H_ */
@@ -0,0 +1,198 @@
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "st7789.h"
+#include "displaylist.h"
+#include "displayserver.h"
+
+#define TAG "DISPLAYSERVER"
+
+// The queue is a bounded MPSC ring after Dmitry Vyukov's MPMC queue.
+// A slot for position pos is free when its sequence is pos, holds a
+// command when it is pos+1, and becomes free for pos+DS_QUEUE_SIZE once
+// the server has taken the command.
+#define DS_MASK (DS_QUEUE_SIZE-1)
+_Static_assert((DS_QUEUE_SIZE & DS_MASK) == 0, "DS_QUEUE_SIZE must be a power of two");
+_Static_assert(DS_QUEUE_SIZE >= DL_MAX_OPS, "a display list must fit in the queue");
+
+// Reserve count consecutive slots
+// first:Position of the first slot
+// Returns false when the queue has no room, it never waits.
+// The server frees slots in order, so when the last one is free all are.
+static bool dsReserve(DISPLAY_SERVER_t * ds, uint32_t count, uint32_t *first) {
+	uint32_t pos = atomic_load_explicit(&ds->enqueue_pos, memory_order_relaxed);
+	while (1) {
+		uint32_t last = pos + count - 1;
+		uint32_t seq = atomic_load_explicit(&ds->cells[last & DS_MASK].sequence, memory_order_acquire);
+		int32_t dif = (int32_t)(seq - last);
+		if (dif == 0) {
+			// On failure pos is reloaded by the exchange
+			if (atomic_compare_exchange_weak_explicit(&ds->enqueue_pos, &pos, pos + count, memory_order_relaxed, memory_order_relaxed)) {
+				*first = pos;
+				return true;
+			}
+		} else if (dif < 0) {
+			atomic_fetch_add_explicit(&ds->dropped, 1, memory_order_relaxed);
+			return false;
+		} else {
+			// Another producer took the slot
+			pos = atomic_load_explicit(&ds->enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+// Hand count filled slots to the server
+// The first slot is published last, the server takes slots in order and
+// so sees either none or all of them.
+static void dsPublish(DISPLAY_SERVER_t * ds, uint32_t first, uint32_t count) {
+	for (uint32_t pos = first + count; pos-- > first;) {
+		atomic_store_explicit(&ds->cells[pos & DS_MASK].sequence, pos + 1, memory_order_release);
+	}
+}
+
+// Oldest command, or NULL when the queue is empty
+static DS_CMD_t * dsPeek(DISPLAY_SERVER_t * ds) {
+	DS_CELL_t *cell = &ds->cells[ds->dequeue_pos & DS_MASK];
+	uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+	if (seq != ds->dequeue_pos + 1) return NULL;
+	return &cell->cmd;
+}
+
+// Give the slot of the oldest command back to the producers
+static void dsRelease(DISPLAY_SERVER_t * ds) {
+	DS_CELL_t *cell = &ds->cells[ds->dequeue_pos & DS_MASK];
+	atomic_store_explicit(&cell->sequence, ds->dequeue_pos + DS_QUEUE_SIZE, memory_order_release);
+	ds->dequeue_pos++;
+}
+
+// True when an op of the list paints the whole screen
+static bool dsFullScreen(DISPLAY_SERVER_t * ds) {
+	for (int i=0;i<ds->list.count;i++) {
+		DL_OP_t *op = &ds->list.ops[i];
+		if (op->type == DL_FILL_RECT && op->x1 == 0 && op->y1 == 0
+			&& op->x2 == ds->dev->_width-1 && op->y2 == ds->dev->_height-1) return true;
+	}
+	return false;
+}
+
+// Draw the ops collected so far
+// A list that paints the whole screen may go through the band buffers,
+// partial updates are drawn straight to the panel or the frame buffer.
+static void dsDrawList(DISPLAY_SERVER_t * ds) {
+	if (ds->list.count == 0) return;
+	if (dsFullScreen(ds)) {
+		lcdDrawBands(ds->dev, dlDraw, &ds->list);
+	} else {
+		dlDraw(ds->dev, &ds->list);
+	}
+	lcdDrawFinish(ds->dev);
+	dlBegin(&ds->list, ds->dev);
+}
+
+// Server task, the only one that touches the device
+// Everything queued when it wakes up is drawn as one list.
+// A submitted list is never split, when it does not fit behind the ops
+// collected so far those are drawn first.
+static void dsTask(void *arg) {
+	DISPLAY_SERVER_t *ds = arg;
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		DS_CMD_t *cmd;
+		while ((cmd = dsPeek(ds)) != NULL) {
+			if (cmd->type == DS_CALL) {
+				dsDrawList(ds);
+				cmd->func(ds->dev, cmd->arg);
+			} else {
+				if (cmd->submit_ops > 0 && (ds->list.count + cmd->submit_ops > DL_MAX_OPS
+					|| ds->list.text_used + cmd->submit_text > DL_TEXT_SIZE)) {
+					dsDrawList(ds);
+				}
+				bool ret = dlAppend(&ds->list, &cmd->op, cmd->text);
+				assert(ret);
+			}
+			dsRelease(ds);
+		}
+		dsDrawList(ds);
+	}
+}
+
+// Start the display server
+// dev:Initialized device, only the server task may use it from now on
+void dsStart(DISPLAY_SERVER_t * ds, TFT_t * dev) {
+	ds->dev = dev;
+	for (int i=0;i<DS_QUEUE_SIZE;i++) {
+		atomic_init(&ds->cells[i].sequence, i);
+	}
+	atomic_init(&ds->enqueue_pos, 0);
+	ds->dequeue_pos = 0;
+	atomic_init(&ds->dropped, 0);
+	dlBegin(&ds->list, dev);
+	BaseType_t ret = xTaskCreate(dsTask, "lcd_server", DS_TASK_STACK, ds, DS_TASK_PRIORITY, &ds->task);
+	assert(ret==pdPASS);
+}
+
+// Post the ops of a display list
+// The ops are copied, dl can be recorded again as soon as this returns.
+// Images of blit ops must stay valid until they are drawn.
+// The server draws the list as a whole, never a part of it.
+// Returns ESP_ERR_NO_MEM when the queue is full, try again later, and
+// ESP_ERR_INVALID_SIZE when a string is longer than DS_TEXT_SIZE-1 bytes.
+// Nothing is posted in both cases.
+esp_err_t dsSubmit(DISPLAY_SERVER_t * ds, const DISPLAY_LIST_t * dl) {
+	uint32_t count = 0;
+	uint32_t text = 0;
+	for (int i=0;i<dl->count;i++) {
+		const DL_OP_t *op = &dl->ops[i];
+		if (op->type == DL_NOP) continue;
+		if (op->type == DL_STRING) {
+			size_t length = strlen(&dl->text[op->string.text]);
+			if (length >= DS_TEXT_SIZE) {
+				ESP_LOGE(TAG, "string of %d bytes does not fit in a command", (int)length);
+				return ESP_ERR_INVALID_SIZE;
+			}
+			text += length + 1;
+		}
+		count++;
+	}
+	if (count == 0) return ESP_OK;
+
+	uint32_t first;
+	if (!dsReserve(ds, count, &first)) return ESP_ERR_NO_MEM;
+	uint32_t pos = first;
+	for (int i=0;i<dl->count;i++) {
+		const DL_OP_t *op = &dl->ops[i];
+		if (op->type == DL_NOP) continue;
+		DS_CMD_t *cmd = &ds->cells[pos & DS_MASK].cmd;
+		if (op->type == DL_STRING) {
+			const char *string = &dl->text[op->string.text];
+			memcpy(cmd->text, string, strlen(string) + 1);
+		}
+		cmd->type = DS_OP;
+		cmd->submit_ops = (pos == first) ? count : 0;
+		cmd->submit_text = (pos == first) ? text : 0;
+		cmd->op = *op;
+		pos++;
+	}
+	dsPublish(ds, first, count);
+	xTaskNotifyGive(ds->task);
+	return ESP_OK;
+}
+
+// Run func(dev, arg) on the server task
+// Ops posted before are drawn first, e.g. for lcdBacklightOff or a whole
+// lcdDrawBands frame. Returns false when the queue is full.
+bool dsCall(DISPLAY_SERVER_t * ds, DRAW_FUNC_t func, void *arg) {
+	uint32_t pos;
+	if (!dsReserve(ds, 1, &pos)) return false;
+	DS_CMD_t *cmd = &ds->cells[pos & DS_MASK].cmd;
+	cmd->type = DS_CALL;
+	cmd->func = func;
+	cmd->arg = arg;
+	dsPublish(ds, pos, 1);
+	xTaskNotifyGive(ds->task);
+	return true;
+}
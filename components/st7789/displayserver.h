@@ -0,0 +1,52 @@
+#ifndef MAIN_DISPLAYSERVER_H_
+#define MAIN_DISPLAYSERVER_H_
+
+#include <stdatomic.h>
+
+#include "esp_err.h"
+
+#include "st7789.h"
+#include "displaylist.h"
+
+// Commands waiting for the server, a power of two of at least DL_MAX_OPS
+#define DS_QUEUE_SIZE 64
+#define DS_TEXT_SIZE 40 // bytes of string per queued op
+#define DS_TASK_STACK 4096
+#define DS_TASK_PRIORITY 4
+
+typedef enum {
+	DS_OP,	// draw op
+	DS_CALL,	// call func on the server task
+} DS_CMD_TYPE_t;
+
+typedef struct {
+	uint8_t type;
+	uint8_t submit_ops;	// ops of the dsSubmit, on its first command only
+	uint16_t submit_text;	// string bytes of the dsSubmit, on its first command only
+	DL_OP_t op;
+	char text[DS_TEXT_SIZE];	// string of a DL_STRING op
+	DRAW_FUNC_t func;
+	void *arg;
+} DS_CMD_t;
+
+// One queue slot.
+// sequence tells producers and the server whose turn the slot is.
+typedef struct {
+	atomic_uint sequence;
+	DS_CMD_t cmd;
+} DS_CELL_t;
+
+typedef struct {
+	TFT_t *dev;
+	TaskHandle_t task;
+	DS_CELL_t cells[DS_QUEUE_SIZE];
+	atomic_uint enqueue_pos;
+	uint32_t dequeue_pos;	// only used by the server task
+	atomic_uint dropped;	// commands refused because the queue was full
+	DISPLAY_LIST_t list;	// ops collected for the next draw
+} DISPLAY_SERVER_t;
+
+void dsStart(DISPLAY_SERVER_t * ds, TFT_t * dev);
+esp_err_t dsSubmit(DISPLAY_SERVER_t * ds, const DISPLAY_LIST_t * dl);
+bool dsCall(DISPLAY_SERVER_t * ds, DRAW_FUNC_t func, void *arg);
+#endif /* MAIN_DISPLAYSERVER_H_ */
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "fontx.h"
+#include "fontstore.h"
+
+#define TAG "FONTSTORE"
+
+// The mapped partition, stays mapped for the life of the fonts
+static const uint8_t *store;
+static size_t store_size;
+static esp_partition_mmap_handle_t store_handle;
+
+// Map the font store partition
+// label:Partition name in partitions.csv
+// Glyphs are then read through the flash cache, nothing is copied to RAM.
+esp_err_t OpenFontxStore(const char *label)
+{
+	if (store != NULL) return ESP_OK;
+
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+	if (partition == NULL) {
+		ESP_LOGE(TAG, "Partition %s not found", label);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	const void *ptr;
+	esp_err_t ret = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &store_handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to map partition %s (%s)", label, esp_err_to_name(ret));
+		return ret;
+	}
+
+	const FONTSTORE_HEADER_t *header = ptr;
+	size_t max_count = (partition->size - sizeof(FONTSTORE_HEADER_t)) / sizeof(FONTSTORE_ENTRY_t);
+	if (memcmp(header->magic, FONTSTORE_MAGIC, sizeof(header->magic)) != 0 || header->count > max_count) {
+		ESP_LOGE(TAG, "Partition %s holds no font store", label);
+		esp_partition_munmap(store_handle);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	store = ptr;
+	store_size = partition->size;
+	ESP_LOGI(TAG, "%"PRIu32" fonts in partition %s", header->count, label);
+	return ESP_OK;
+}
+
+// Initialize FontxFile structure with a font of the store
+// name:File name the font was stored with, e.g. "ILGH16XB.FNT"
+// Returns false when the store is not open or has no such font.
+bool InitFontxStore(FontxFile *fxs, const char *name)
+{
+	if (store == NULL) return false;
+
+	const FONTSTORE_HEADER_t *header = (const FONTSTORE_HEADER_t *)store;
+	const FONTSTORE_ENTRY_t *entry = (const FONTSTORE_ENTRY_t *)&header[1];
+	for (int i=0;i<header->count;i++,entry++) {
+		if (strncmp(entry->name, name, FONTSTORE_NAME_SIZE) != 0) continue;
+		if (entry->offset > store_size || entry->size > store_size - entry->offset) {
+			ESP_LOGE(TAG, "%s is outside the partition", name);
+			return false;
+		}
+		InitFontxMemory(fxs, name, &store[entry->offset], entry->size);
+		return true;
+	}
+	ESP_LOGW(TAG, "%s not in the font store", name);
+	return false;
+}
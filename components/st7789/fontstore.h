@@ -0,0 +1,31 @@
+#ifndef MAIN_FONTSTORE_H_
+#define MAIN_FONTSTORE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "fontx.h"
+
+// Font store, a raw data partition holding FONTX files
+// Built by mkfontstore.py. All numbers are little endian.
+//   header:  magic "FNTS", number of fonts
+//   entries: one FONTSTORE_ENTRY_t per font
+//   fonts:   the FONTX files, each aligned to 4 bytes
+#define FONTSTORE_MAGIC "FNTS"
+#define FONTSTORE_NAME_SIZE 16
+
+typedef struct {
+	char magic[4];
+	uint32_t count;
+} FONTSTORE_HEADER_t;
+
+typedef struct {
+	char name[FONTSTORE_NAME_SIZE];	// file name, NUL padded
+	uint32_t offset;	// from the start of the partition
+	uint32_t size;
+} FONTSTORE_ENTRY_t;
+
+esp_err_t OpenFontxStore(const char *label);
+bool InitFontxStore(FontxFile *fxs, const char *name);
+#endif /* MAIN_FONTSTORE_H_ */
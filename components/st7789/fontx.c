@@ -20,6 +20,16 @@ void AddFontx(FontxFile *fx, const char *path)
 	fx->opened = false;
 }
 
+// Use a FONTX image in memory, e.g. in flash, instead of a file
+// name:Used in messages only
+// data:Stays in use until CloseFontx, glyphs are not copied
+void AddFontxMemory(FontxFile *fx, const char *name, const uint8_t *data, size_t size)
+{
+	AddFontx(fx, name);
+	fx->data = data;
+	fx->size = size;
+}
+
 // Initialize FontxFile structure
 // フォント構造体を初期化
 void InitFontx(FontxFile *fxs, const char *f0, const char *f1)
@@ -28,11 +38,70 @@ void InitFontx(FontxFile *fxs, const char *f0, const char *f1)
 	AddFontx(&fxs[1], f1);
 }
 
+// Initialize FontxFile structure with one FONTX image in memory
+void InitFontxMemory(FontxFile *fxs, const char *name, const uint8_t *data, size_t size)
+{
+	AddFontxMemory(&fxs[0], name, data, size);
+	AddFontx(&fxs[1], "");
+}
+
+#if CONFIG_FONTX_RESIDENT
+// Read all 256 glyphs of an ANK font
+// Falls back to reading glyph by glyph when the table does not fit in memory.
+static bool OpenFontxTable(FontxFile *fx)
+{
+	size_t size = 256 * fx->fsz;
+	unsigned char *table = (unsigned char*)malloc(size);
+	if (table == NULL) {
+		ESP_LOGW(__FUNCTION__, "No memory for the %d byte table of %s", (int)size, fx->path);
+		return false;
+	}
+	if (fseek(fx->file, 17, SEEK_SET) || fread(table, 1, size, fx->file) != size) {
+		printf("Fontx:%s table read failed.\n",fx->path);
+		free(table);
+		return false;
+	}
+	fx->table = table;
+	return true;
+}
+#endif
+
+// Open font image in memory
+// The glyph table points into the image.
+static bool OpenFontxMemory(FontxFile *fx)
+{
+	const uint8_t *buf = fx->data;
+	fx->valid = false;
+	if (fx->size < 18) {
+		printf("Fontx:%s not FONTX format.\n",fx->path);
+		return fx->valid;
+	}
+
+	memcpy(fx->fxname, &buf[6], 8);
+	fx->w = buf[14];
+	fx->h = buf[15];
+	fx->is_ank = (buf[16] == 0);
+	fx->bc = buf[17];
+	fx->fsz = (fx->w + 7)/8 * fx->h;
+	if (!fx->is_ank || fx->size < 17 + 256 * fx->fsz) {
+		printf("Fontx:%s is not a complete ANK font.\n",fx->path);
+		return fx->valid;
+	}
+	fx->table = &buf[17];
+	fx->opened = true;
+	fx->valid = true;
+	return fx->valid;
+}
+
 // Open font file
 // フォントファイルをOPEN
+// With CONFIG_FONTX_RESIDENT the glyphs of ANK fonts are loaded here.
 bool OpenFontx(FontxFile *fx)
 {
 	FILE *f;
+	if(!fx->opened && fx->data){
+		return OpenFontxMemory(fx);
+	}
 	if(!fx->opened){
 		if(FontxDebug)printf("[openFont]fx->path=[%s]\n",fx->path);
 		f = fopen(fx->path, "r");
@@ -68,6 +137,17 @@ bool OpenFontx(FontxFile *fx)
 		fx->fsz = (fx->w + 7)/8 * fx->h;
 		if(FontxDebug)printf("[openFont]fx->fsz=%d\n",fx->fsz);
 
+#if CONFIG_FONTX_RESIDENT
+		// Keep the whole ANK table in memory and close the file
+		if (fx->is_ank && OpenFontxTable(fx)) {
+			fclose(fx->file);
+			fx->file = NULL;
+			fx->opened = true;
+			fx->valid = true;
+			return fx->valid;
+		}
+#endif
+
 		// Allocate Glyph memory
 		unsigned char *fonts = (unsigned char*)malloc(fx->fsz);
 		if (fonts == NULL) {
@@ -90,10 +170,12 @@ bool OpenFontx(FontxFile *fx)
 void CloseFontx(FontxFile *fx)
 {
 	if(fx->opened){
-		fclose(fx->file);
+		if (fx->file) fclose(fx->file);
 		fx->file = NULL;
 		free(fx->fonts);
 		fx->fonts = NULL;
+		if (fx->data == NULL) free((void *)fx->table);
+		fx->table = NULL;
 		fx->opened = false;
 		fx->valid = false;
 	}
@@ -227,7 +309,27 @@ uint8_t getFortHeight(FontxFile *fx) {
 
 */
 
-bool GetFontx(FontxFile *fxs, uint8_t ascii, uint8_t *pw, uint8_t *ph)
+// Get glyph size without reading a glyph
+// Unlike GetFontx this leaves the glyph buffer alone, so it can be called
+// while another task draws with the same fonts.
+bool GetFontxSize(FontxFile *fxs, uint8_t *pw, uint8_t *ph)
+{
+	for(int i=0; i<2; i++){
+		if(!OpenFontx(&fxs[i])) continue;
+		if(fxs[i].is_ank){
+			if(pw) *pw = fxs[i].w;
+			if(ph) *ph = fxs[i].h;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Get glyph of ascii
+// Returns the glyph bitmap, or NULL when no font has it.
+// A resident table is indexed directly, otherwise the glyph is read into
+// the buffer of the font and stays valid until the next read.
+const uint8_t *GetFontxGlyph(FontxFile *fxs, uint8_t ascii, uint8_t *pw, uint8_t *ph)
 {
 	int i;
 	uint32_t offset;
@@ -240,23 +342,31 @@ bool GetFontx(FontxFile *fxs, uint8_t ascii, uint8_t *pw, uint8_t *ph)
 		// Check ANK font
 		if(fxs[i].is_ank){
 			if(FontxDebug)printf("[GetFontx]fxs.is_ank fxs.fsz=%d\n",fxs[i].fsz);
+			if(pw) *pw = fxs[i].w;
+			if(ph) *ph = fxs[i].h;
+			if(fxs[i].table) return &fxs[i].table[ascii * fxs[i].fsz];
+
 			offset = 17 + ascii * fxs[i].fsz;
 			if(FontxDebug)printf("[GetFontx]offset=%"PRIu32"\n",offset);
 			if(fseek(fxs[i].file, offset, SEEK_SET)) {
 				printf("Fontx:seek(%"PRIu32") failed.\n",offset);
-				return false;
+				return NULL;
 			}
 			//if(fread(pGlyph, 1, fxs[i].fsz, fxs[i].file) != fxs[i].fsz) {
-			if(fread(fxs->fonts, 1, fxs[i].fsz, fxs[i].file) != fxs[i].fsz) {
+			if(fread(fxs[i].fonts, 1, fxs[i].fsz, fxs[i].file) != fxs[i].fsz) {
 				printf("Fontx:fread failed.\n");
-				return false;
+				return NULL;
 			}
-			if(pw) *pw = fxs[i].w;
-			if(ph) *ph = fxs[i].h;
-			return true;
+			return fxs[i].fonts;
 		}
 	}
-	return false;
+	return NULL;
+}
+
+// Get glyph size of ascii, see GetFontxGlyph
+bool GetFontx(FontxFile *fxs, uint8_t ascii, uint8_t *pw, uint8_t *ph)
+{
+	return GetFontxGlyph(fxs, ascii, pw, ph) != NULL;
 }
 
 
@@ -13,16 +13,23 @@ typedef struct {
 	uint8_t bc;
 	FILE *file;
 	unsigned char *fonts;
+	const unsigned char *table;	// all glyphs of a resident ANK font
+	const uint8_t *data;	// FONTX image in memory instead of a file
+	size_t size;
 } FontxFile;
 
-void AaddFontx(FontxFile *fx, const char *path);
+void AddFontx(FontxFile *fx, const char *path);
 void InitFontx(FontxFile *fxs, const char *f0, const char *f1);
+void AddFontxMemory(FontxFile *fx, const char *name, const uint8_t *data, size_t size);
+void InitFontxMemory(FontxFile *fxs, const char *name, const uint8_t *data, size_t size);
 bool OpenFontx(FontxFile *fx);
 void CloseFontx(FontxFile *fx);
 void DumpFontx(FontxFile *fxs);
 uint8_t getFortWidth(FontxFile *fx);
 uint8_t getFortHeight(FontxFile *fx);
 bool GetFontx(FontxFile *fxs, uint8_t ascii , uint8_t *pw, uint8_t *ph);
+const uint8_t *GetFontxGlyph(FontxFile *fxs, uint8_t ascii, uint8_t *pw, uint8_t *ph);
+bool GetFontxSize(FontxFile *fxs, uint8_t *pw, uint8_t *ph);
 void Font2Bitmap(uint8_t *fonts, uint8_t *line, uint8_t w, uint8_t h, uint8_t inverse);
 void UnderlineBitmap(uint8_t *line, uint8_t w, uint8_t h);
 void ReversBitmap(uint8_t *line, uint8_t w, uint8_t h);
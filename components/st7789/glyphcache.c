@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "st7789.h"
+#include "fontx.h"
+#include "glyphcache.h"
+
+#define TAG "GLYPHCACHE"
+
+#ifndef CONFIG_GLYPH_CACHE_SIZE
+#define CONFIG_GLYPH_CACHE_SIZE 8
+#endif
+#define GLYPH_CACHE_BYTES (CONFIG_GLYPH_CACHE_SIZE * 1024)
+
+// One glyph expanded to RGB565 in panel byte order.
+// Pixels are in the order of a window write for the font direction.
+typedef struct {
+	FontxFile *fx;	// NULL when the entry is free
+	uint8_t ascii;
+	uint8_t direction;
+	bool underline;
+	uint16_t color;
+	uint16_t bg;
+	uint16_t underline_color;
+	uint8_t w;	// window width
+	uint8_t h;	// window height
+	uint32_t last_use;
+	uint16_t *pixels;
+} GLYPH_ENTRY_t;
+
+static GLYPH_ENTRY_t entries[GLYPH_CACHE_ENTRIES];
+static uint32_t used_bytes;
+static uint32_t use_count;
+static uint32_t hits;
+static uint32_t misses;
+
+static void glyphCacheFree(GLYPH_ENTRY_t *e) {
+	used_bytes -= e->w * e->h * sizeof(uint16_t);
+	free(e->pixels);
+	e->pixels = NULL;
+	e->fx = NULL;
+}
+
+// Least recently used entry holding a glyph
+static GLYPH_ENTRY_t *glyphCacheOldest(void) {
+	GLYPH_ENTRY_t *oldest = NULL;
+	for (int i=0;i<GLYPH_CACHE_ENTRIES;i++) {
+		if (entries[i].fx == NULL) continue;
+		if (oldest == NULL || entries[i].last_use < oldest->last_use) oldest = &entries[i];
+	}
+	return oldest;
+}
+
+// Expand a glyph into a window of the font direction
+// Direction 0 keeps the glyph rows, direction 3 turns them into columns
+// running upwards, the same pixels lcdDrawChar draws.
+static void glyphExpand(GLYPH_ENTRY_t *e, const uint8_t *glyph, uint8_t pw, uint8_t ph) {
+	int stride = (pw + 7) / 8;
+	uint16_t fg = SWAP16(e->color);
+	uint16_t bg = SWAP16(e->bg);
+	uint16_t ul = SWAP16(e->underline_color);
+	uint16_t *dst = e->pixels;
+	for (int r=0;r<e->h;r++) {
+		for (int c=0;c<e->w;c++) {
+			int gh = (e->direction == 0) ? r : c;
+			int gw = (e->direction == 0) ? c : (pw-1) - r;
+			if (e->underline && gh >= ph-2) {
+				*dst++ = ul;
+			} else {
+				*dst++ = (glyph[gh*stride + gw/8] & (0x80 >> (gw%8))) ? fg : bg;
+			}
+		}
+	}
+}
+
+// Get a glyph as expanded RGB565 pixels
+// direction:Font direction, 0 or 3
+// color:Glyph color
+// bg:Background color
+// underline:Draw the last two rows in underline_color
+// cw:Window width
+// ch:Window height
+// Returns NULL when the glyph is missing or does not fit in the budget.
+// Entries are evicted least recently used first.
+const uint16_t *glyphCacheGet(FontxFile *fx, uint8_t ascii, uint8_t direction, uint16_t color, uint16_t bg,
+	bool underline, uint16_t underline_color, uint8_t *cw, uint8_t *ch) {
+	if (direction != 0 && direction != 3) return NULL;
+	if (!underline) underline_color = 0;
+	use_count++;
+
+	for (int i=0;i<GLYPH_CACHE_ENTRIES;i++) {
+		GLYPH_ENTRY_t *e = &entries[i];
+		if (e->fx == fx && e->ascii == ascii && e->direction == direction && e->color == color
+			&& e->bg == bg && e->underline == underline && e->underline_color == underline_color) {
+			e->last_use = use_count;
+			*cw = e->w;
+			*ch = e->h;
+			hits++;
+			return e->pixels;
+		}
+	}
+
+	uint8_t pw, ph;
+	const uint8_t *glyph = GetFontxGlyph(fx, ascii, &pw, &ph);
+	if (glyph == NULL) return NULL;
+	uint32_t size = pw * ph * sizeof(uint16_t);
+	if (size > GLYPH_CACHE_BYTES) return NULL;
+	misses++;
+
+	// Make room, then take a free entry
+	while (used_bytes + size > GLYPH_CACHE_BYTES) {
+		glyphCacheFree(glyphCacheOldest());
+	}
+	GLYPH_ENTRY_t *e = NULL;
+	for (int i=0;i<GLYPH_CACHE_ENTRIES && e == NULL;i++) {
+		if (entries[i].fx == NULL) e = &entries[i];
+	}
+	if (e == NULL) {
+		e = glyphCacheOldest();
+		glyphCacheFree(e);
+	}
+	e->pixels = malloc(size);
+	if (e->pixels == NULL) {
+		ESP_LOGW(TAG, "Error allocating memory for a %dx%d glyph", pw, ph);
+		return NULL;
+	}
+
+	e->fx = fx;
+	e->ascii = ascii;
+	e->direction = direction;
+	e->color = color;
+	e->bg = bg;
+	e->underline = underline;
+	e->underline_color = underline_color;
+	e->w = (direction == 0) ? pw : ph;
+	e->h = (direction == 0) ? ph : pw;
+	e->last_use = use_count;
+	used_bytes += size;
+	glyphExpand(e, glyph, pw, ph);
+	*cw = e->w;
+	*ch = e->h;
+	return e->pixels;
+}
+
+// Drop all glyphs, e.g. after fonts were closed
+void glyphCacheClear(void) {
+	for (int i=0;i<GLYPH_CACHE_ENTRIES;i++) {
+		if (entries[i].fx != NULL) glyphCacheFree(&entries[i]);
+	}
+}
+
+// Lookups served from the cache and glyphs expanded since start up
+void glyphCacheStats(uint32_t *hit_count, uint32_t *miss_count) {
+	*hit_count = hits;
+	*miss_count = misses;
+}
@@ -0,0 +1,13 @@
+#ifndef MAIN_GLYPHCACHE_H_
+#define MAIN_GLYPHCACHE_H_
+
+#include "fontx.h"
+
+// Most glyphs held at a time, the memory budget is CONFIG_GLYPH_CACHE_SIZE
+#define GLYPH_CACHE_ENTRIES 64
+
+const uint16_t *glyphCacheGet(FontxFile *fx, uint8_t ascii, uint8_t direction, uint16_t color, uint16_t bg,
+	bool underline, uint16_t underline_color, uint8_t *cw, uint8_t *ch);
+void glyphCacheClear(void);
+void glyphCacheStats(uint32_t *hits, uint32_t *misses);
+#endif /* MAIN_GLYPHCACHE_H_ */
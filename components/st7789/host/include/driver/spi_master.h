@@ -0,0 +1,51 @@
+// Host stand-in for the ESP-IDF driver/spi_master.h, see ../mock.c
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+typedef enum { SPI1_HOST = 0, SPI2_HOST = 1, SPI3_HOST = 2 } spi_host_device_t;
+#define SPI_DMA_CH_AUTO 3
+#define SPI_MASTER_FREQ_20M (80*1000*1000/4)
+#define SPI_MASTER_FREQ_26M (80*1000*1000/3)
+#define SPI_MASTER_FREQ_40M (80*1000*1000/2)
+#define SPI_MASTER_FREQ_80M (80*1000*1000/1)
+#define SPI_DEVICE_NO_DUMMY (1<<6)
+#define SPI_TRANS_USE_RXDATA (1<<2)
+#define SPI_TRANS_USE_TXDATA (1<<3)
+typedef struct {
+	int mosi_io_num, miso_io_num, sclk_io_num, quadwp_io_num, quadhd_io_num;
+	int max_transfer_sz;
+	uint32_t flags;
+} spi_bus_config_t;
+struct spi_transaction_t;
+typedef void (*transaction_cb_t)(struct spi_transaction_t *trans);
+typedef struct {
+	uint8_t command_bits, address_bits, dummy_bits, mode;
+	int clock_speed_hz;
+	int spics_io_num;
+	uint32_t flags;
+	int queue_size;
+	transaction_cb_t pre_cb;
+	transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+typedef struct spi_transaction_t {
+	uint32_t flags;
+	uint16_t cmd;
+	uint64_t addr;
+	size_t length;
+	size_t rxlength;
+	void *user;
+	union { const void *tx_buffer; uint8_t tx_data[4]; };
+	union { void *rx_buffer; uint8_t rx_data[4]; };
+} spi_transaction_t;
+typedef struct spi_device_t *spi_device_handle_t;
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle);
+esp_err_t spi_device_transmit(spi_device_handle_t h, spi_transaction_t *t);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t h, spi_transaction_t *t);
+esp_err_t spi_device_queue_trans(spi_device_handle_t h, spi_transaction_t *t, TickType_t wait);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t h, spi_transaction_t **t, TickType_t wait);
+esp_err_t spi_device_acquire_bus(spi_device_handle_t h, TickType_t wait);
+void spi_device_release_bus(spi_device_handle_t h);
@@ -0,0 +1,3 @@
+// Host stand-in for the ESP-IDF esp_attr.h, see ../mock.c
+#pragma once
+#define IRAM_ATTR
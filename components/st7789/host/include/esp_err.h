@@ -0,0 +1,13 @@
+// Host stand-in for the ESP-IDF esp_err.h, see ../mock.c
+#pragma once
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+const char *esp_err_to_name(esp_err_t);
+#define ESP_ERROR_CHECK(x) do { esp_err_t e_ = (x); assert(e_ == ESP_OK); (void)e_; } while (0)
@@ -0,0 +1,11 @@
+// Host stand-in for the ESP-IDF esp_log.h, see ../mock.c
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+extern int mock_log_level;
+#define ESP_LOG_(lvl, tag, fmt, ...) do { if (mock_log_level >= lvl) printf("%c (%s) " fmt "\n", "NEWIDV"[lvl], tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_(1, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_(2, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_(3, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ESP_LOG_(4, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) ESP_LOG_(5, tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,4 @@
+// Host stand-in for the ESP-IDF esp_system.h, see ../mock.c
+#pragma once
+#include <stdint.h>
+uint32_t esp_get_free_heap_size(void);
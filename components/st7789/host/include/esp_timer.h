@@ -0,0 +1,4 @@
+// Host stand-in for the ESP-IDF esp_timer.h, see ../mock.c
+#pragma once
+#include <stdint.h>
+int64_t esp_timer_get_time(void);
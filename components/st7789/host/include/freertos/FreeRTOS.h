@@ -0,0 +1,21 @@
+// Host stand-in for the ESP-IDF freertos/FreeRTOS.h, see ../mock.c
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define portTICK_PERIOD_MS ((TickType_t)10)
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdMS_TO_TICKS(x) ((x)/10)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define tskNO_AFFINITY 0x7fffffff
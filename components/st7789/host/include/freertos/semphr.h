@@ -0,0 +1,9 @@
+// Host stand-in for the ESP-IDF freertos/semphr.h, see ../mock.c
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef struct mock_sem *SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+void vSemaphoreDelete(SemaphoreHandle_t s);
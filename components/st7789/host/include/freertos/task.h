@@ -0,0 +1,14 @@
+// Host stand-in for the ESP-IDF freertos/task.h, see ../mock.c
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+void vTaskDelay(TickType_t t);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *h, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *h);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xPortGetCoreID(void);
+void vTaskDelete(TaskHandle_t h);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t h);
@@ -0,0 +1,293 @@
+// Run the st7789 driver on the host and report the SPI traffic of each primitive
+//
+// usage: st7789_host [-c golden | -w golden] [font] [ppm]
+// -c  :Check each primitive against a golden file, exit 1 on a mismatch
+// -w  :Write the results to a golden file
+// font:FONTX file used for text, default ../../../fonts/ILGH16XB.FNT
+// ppm :Where the final panel image is saved, default panel.ppm
+//
+// A golden file has one line per primitive: the CRC-32 of the panel image
+// after the primitive, the most SPI transactions it may take and its name.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "st7789.h"
+#include "fontx.h"
+#include "fontstore.h"
+#include "displaylist.h"
+#include "mock.h"
+
+// TTGO T-Display
+#define WIDTH 135
+#define HEIGHT 240
+#define OFFSETX 52
+#define OFFSETY 40
+
+typedef void (*HOST_FUNC_t)(TFT_t * dev, FontxFile *fx);
+
+static uint16_t image[32*32];
+
+// The text font again, read from an emulated font store partition
+static FontxFile store_fx[2];
+
+static void hostPixels(TFT_t * dev, FontxFile *fx) {
+	for(int i=0;i<100;i++) {
+		lcdDrawPixel(dev, i, i, RED);
+	}
+}
+
+static void hostLine(TFT_t * dev, FontxFile *fx) {
+	lcdDrawLine(dev, 0, 0, dev->_width-1, dev->_height-1, BLUE);
+}
+
+static void hostRect(TFT_t * dev, FontxFile *fx) {
+	lcdDrawRect(dev, 10, 10, dev->_width-11, dev->_height-11, BLACK);
+}
+
+static void hostCircle(TFT_t * dev, FontxFile *fx) {
+	lcdDrawCircle(dev, dev->_width/2, dev->_height/2, dev->_width/3, GREEN);
+}
+
+static void hostFillCircle(TFT_t * dev, FontxFile *fx) {
+	lcdDrawFillCircle(dev, dev->_width/2, dev->_height/2, dev->_width/3, GREEN);
+}
+
+static void hostTriangle(TFT_t * dev, FontxFile *fx) {
+	lcdDrawFillTriangle(dev, dev->_width/2, dev->_height/2, 40, 40, 30, PURPLE);
+}
+
+static void hostString(TFT_t * dev, FontxFile *fx) {
+	lcdDrawString(dev, fx, 0, dev->_height/2, (uint8_t *)"Scanning WiFi...", BLACK);
+}
+
+// Text on a background color, which pages.c uses for all its text
+static void hostStringFill(TFT_t * dev, FontxFile *fx) {
+	lcdSetFontFill(dev, CYAN);
+	lcdDrawString(dev, fx, 0, dev->_height/2, (uint8_t *)"Scanning WiFi...", BLACK);
+	lcdUnsetFontFill(dev);
+}
+
+// The string drawn with the font from the font store
+static void hostStoreFont(TFT_t * dev, FontxFile *fx) {
+	lcdDrawString(dev, store_fx, 0, dev->_height/2, (uint8_t *)"Scanning WiFi...", BLACK);
+}
+
+static void hostFillRect(TFT_t * dev, FontxFile *fx) {
+	lcdDrawFillRect(dev, 10, 10, 40, 40, PURPLE);
+}
+
+// Corners given the wrong way round draw nothing
+static void hostReversedRect(TFT_t * dev, FontxFile *fx) {
+	lcdDrawFillRect(dev, 40, 10, 10, 40, PURPLE);
+	lcdDrawFillRect(dev, 10, 40, 40, 10, PURPLE);
+}
+
+static void hostScreen(TFT_t * dev, FontxFile *fx) {
+	lcdFillScreen(dev, WHITE);
+}
+
+static void hostBlit(TFT_t * dev, FontxFile *fx) {
+	lcdBlit(dev, 20, 20, image, 32, 0, 0, 32, 32);
+}
+
+static void hostBlitKey(TFT_t * dev, FontxFile *fx) {
+	lcdBlitKey(dev, 20, 60, image, 32, 0, 0, 32, 32, image[0]);
+}
+
+// A page as pages.c draws it
+static void hostPage(TFT_t * dev, FontxFile *fx) {
+	static DISPLAY_LIST_t dl;
+	static const char *ssid[] = {"HomeNet", "Cafe Free WiFi", "xfinity", "Neighbour 5G"};
+	uint8_t fw, fh;
+	GetFontx(fx, 0, &fw, &fh);
+
+	dlBegin(&dl, dev);
+	dlFillScreen(&dl, WHITE);
+	for(int i=0;i<4;i++) {
+		if (i == 1) dlDrawFillTriangle(&dl, fh/2, fh/2 + fh*(i+1) - 1, fh-4, fh-4, 90, RED);
+		dlDrawString(&dl, fx, fh, fh*(i+2) - 1, (uint8_t *)ssid[i], BLACK);
+	}
+	dlSetFontUnderLine(&dl, BLUE);
+	dlDrawString(&dl, fx, fh, fh*7 - 1, (uint8_t *)"Exit", BLUE);
+	dlUnsetFontUnderLine(&dl);
+	lcdDrawBands(dev, dlDraw, &dl);
+}
+
+// Result of one primitive
+typedef struct {
+	uint32_t crc;
+	uint64_t transactions;
+} HOST_RESULT_t;
+
+// CRC-32 of the visible panel image
+static uint32_t hostPanelCrc(void) {
+	uint32_t crc = 0xFFFFFFFF;
+	for(int y=0;y<HEIGHT;y++) {
+		for(int x=0;x<WIDTH;x++) {
+			uint16_t c = mock_panel_visible(x+OFFSETX, y+OFFSETY);
+			uint8_t bytes[2] = {c >> 8, c & 0xFF};
+			for(int i=0;i<2;i++) {
+				crc ^= bytes[i];
+				for(int k=0;k<8;k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+			}
+		}
+	}
+	return ~crc;
+}
+
+// Look up a primitive in a golden file
+static bool hostGolden(FILE *f, const char *name, HOST_RESULT_t *golden) {
+	char line[128];
+	rewind(f);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned int crc;
+		uint64_t transactions;
+		int n;
+		if (sscanf(line, "%x %"SCNu64" %n", &crc, &transactions, &n) != 2) continue;
+		line[strcspn(line, "\n")] = '\0';
+		if (strcmp(&line[n], name) != 0) continue;
+		golden->crc = crc;
+		golden->transactions = transactions;
+		return true;
+	}
+	return false;
+}
+
+// Pack a FONTX file into a font store partition, like mkfontstore.py does
+// Returns false when the file cannot be read or the store does not open.
+static bool hostFontStore(const char *font) {
+	static uint8_t store[sizeof(FONTSTORE_HEADER_t) + sizeof(FONTSTORE_ENTRY_t) + 64*1024];
+	FONTSTORE_HEADER_t *header = (FONTSTORE_HEADER_t *)store;
+	FONTSTORE_ENTRY_t *entry = (FONTSTORE_ENTRY_t *)&header[1];
+	size_t offset = sizeof(*header) + sizeof(*entry);
+
+	FILE *f = fopen(font, "rb");
+	if (f == NULL) return false;
+	size_t size = fread(&store[offset], 1, sizeof(store) - offset, f);
+	fclose(f);
+
+	memcpy(header->magic, FONTSTORE_MAGIC, sizeof(header->magic));
+	header->count = 1;
+	memset(entry, 0, sizeof(*entry));
+	strncpy(entry->name, "FONT.FNT", sizeof(entry->name));
+	entry->offset = offset;
+	entry->size = size;
+	mock_set_partition("fonts", store, offset + size);
+	if (OpenFontxStore("fonts") != ESP_OK) return false;
+	return InitFontxStore(store_fx, "FONT.FNT");
+}
+
+// Run one primitive and print the traffic it caused
+static HOST_RESULT_t hostRun(TFT_t * dev, FontxFile *fx, const char *name, HOST_FUNC_t func) {
+	lcdFillScreen(dev, WHITE);
+	lcdDrawFinish(dev);
+	lcdWaitFinish(dev);
+	spi_master_fence(dev);
+
+	mock_reset_stats();
+	func(dev, fx);
+	lcdDrawFinish(dev);
+	lcdWaitFinish(dev);
+	spi_master_fence(dev);
+	printf("%-12s %7"PRIu64" %8"PRIu64" %7"PRIu64" %7"PRIu64" %7"PRIu64" %9"PRIu64"\n",
+		name, mock_stats.transactions, mock_stats.bytes, mock_stats.commands,
+		mock_stats.dc_toggles, mock_stats.pixels, mock_stats.bus_ns/1000);
+	if (mock_stats.out_of_gram) printf("%-12s %"PRIu64" pixels outside GRAM\n", name, mock_stats.out_of_gram);
+	return (HOST_RESULT_t){hostPanelCrc(), mock_stats.transactions};
+}
+
+int main(int argc, char **argv) {
+	static const struct {
+		const char *name;
+		HOST_FUNC_t func;
+	} runs[] = {
+		{"pixel x100", hostPixels},
+		{"line", hostLine},
+		{"rect", hostRect},
+		{"circle", hostCircle},
+		{"fillcircle", hostFillCircle},
+		{"triangle", hostTriangle},
+		{"string", hostString},
+		{"string fill", hostStringFill},
+		{"store font", hostStoreFont},
+		{"fillrect", hostFillRect},
+		{"reversed", hostReversedRect},
+		{"screen", hostScreen},
+		{"blit", hostBlit},
+		{"blitkey", hostBlitKey},
+		{"page", hostPage},
+	};
+	FILE *check = NULL;
+	FILE *write = NULL;
+	int arg = 1;
+	while (arg+1 < argc && argv[arg][0] == '-') {
+		FILE *f = NULL;
+		if (strcmp(argv[arg], "-c") == 0) {
+			f = check = fopen(argv[arg+1], "r");
+		} else if (strcmp(argv[arg], "-w") == 0) {
+			f = write = fopen(argv[arg+1], "w");
+		} else {
+			break;
+		}
+		if (f == NULL) {
+			printf("cannot open %s\n", argv[arg+1]);
+			return 1;
+		}
+		arg += 2;
+	}
+	const char *font = (argc > arg) ? argv[arg] : "../../../fonts/ILGH16XB.FNT";
+	const char *ppm = (argc > arg+1) ? argv[arg+1] : "panel.ppm";
+
+	for(int i=0;i<32*32;i++) {
+		int x = i % 32, y = i / 32;
+		image[i] = ((x-16)*(x-16) + (y-16)*(y-16) < 200) ? rgb565(x*8, y*8, 128) : BLACK;
+	}
+
+	TFT_t dev;
+	FontxFile fx[2];
+	InitFontx(fx, font, "");
+	if (!hostFontStore(font)) {
+		printf("cannot build a font store from %s\n", font);
+		return 1;
+	}
+	spi_master_init(&dev, 19, 18, 5, mock_dc_gpio, 23, 4);
+	lcdInit(&dev, WIDTH, HEIGHT, OFFSETX, OFFSETY);
+	spi_master_set_async(&dev, true);
+
+	printf("%-12s %7s %8s %7s %7s %7s %9s\n", "primitive", "trans", "bytes", "cmds", "dc", "pixels", "bus us");
+	int failed = 0;
+	for(int i=0;i<sizeof(runs)/sizeof(runs[0]);i++) {
+		HOST_RESULT_t result = hostRun(&dev, fx, runs[i].name, runs[i].func);
+		if (mock_stats.out_of_gram) failed++;
+		if (write != NULL) fprintf(write, "%08"PRIx32" %"PRIu64" %s\n", result.crc, result.transactions, runs[i].name);
+		if (check == NULL) continue;
+
+		HOST_RESULT_t golden;
+		if (!hostGolden(check, runs[i].name, &golden)) {
+			printf("%-12s not in the golden file\n", runs[i].name);
+			failed++;
+			continue;
+		}
+		if (result.crc != golden.crc) {
+			printf("%-12s panel image differs, crc %08"PRIx32" expected %08"PRIx32"\n", runs[i].name, result.crc, golden.crc);
+			failed++;
+		}
+		if (result.transactions > golden.transactions) {
+			printf("%-12s %"PRIu64" transactions, at most %"PRIu64" expected\n", runs[i].name, result.transactions, golden.transactions);
+			failed++;
+		}
+	}
+	if (write != NULL) fclose(write);
+	if (check != NULL) {
+		fclose(check);
+		printf("%s\n", failed ? "FAILED" : "PASSED");
+	}
+
+	if (!mock_write_ppm(ppm, OFFSETX, OFFSETY, WIDTH, HEIGHT)) {
+		printf("cannot write %s\n", ppm);
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,562 @@
+// Host emulation of the ESP-IDF pieces used by the st7789 component
+//
+// FreeRTOS tasks and semaphores run on pthreads, the SPI master executes
+// transactions in queue order and feeds every byte to an emulated ST7789,
+// which keeps its own GRAM image and counts the traffic.
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+
+#include "mock.h"
+
+// Per transaction overhead added to the wire time estimate
+#define TRANS_OVERHEAD_NS 2000
+
+int mock_log_level = 2;
+int mock_dc_gpio = 16;
+MOCK_STATS_t mock_stats;
+uint16_t mock_gram[MOCK_GRAM_HEIGHT][MOCK_GRAM_WIDTH];
+
+// Serializes the SPI emulation between the app and the flush task
+static pthread_mutex_t spi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *esp_err_to_name(esp_err_t err) {
+	(void)err;
+	return "ERROR";
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+	(void)caps;
+	return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+	(void)caps;
+	return calloc(n, size);
+}
+
+void heap_caps_free(void *ptr) {
+	free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+	(void)caps;
+	return 100000;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+	return 100000;
+}
+
+int64_t esp_timer_get_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+//
+// Flash partitions
+//
+
+// The one data partition, see mock_set_partition()
+static esp_partition_t partition;
+static const void *partition_data;
+
+// Serve data as the data partition label
+// data must stay valid while the partition is mapped.
+void mock_set_partition(const char *label, const void *data, size_t size) {
+	memset(&partition, 0, sizeof(partition));
+	partition.type = ESP_PARTITION_TYPE_DATA;
+	partition.size = size;
+	snprintf(partition.label, sizeof(partition.label), "%s", label);
+	partition_data = data;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+	if (partition_data == NULL || type != partition.type) return NULL;
+	if (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != partition.subtype) return NULL;
+	if (label != NULL && strcmp(label, partition.label) != 0) return NULL;
+	return &partition;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *p, size_t offset, size_t size,
+	esp_partition_mmap_memory_t memory, const void **out_ptr, esp_partition_mmap_handle_t *out_handle) {
+	(void)memory;
+	if (p != &partition || offset > p->size || size > p->size - offset) return ESP_ERR_INVALID_ARG;
+	*out_ptr = (const uint8_t *)partition_data + offset;
+	*out_handle = 1;
+	return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+	(void)handle;
+}
+
+//
+// Tasks
+//
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t notify;
+	TaskFunction_t func;
+	void *arg;
+	int core;
+} MOCK_TASK_t;
+
+static MOCK_TASK_t main_task = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+static __thread MOCK_TASK_t *current_task = &main_task;
+
+static void *taskEntry(void *arg) {
+	MOCK_TASK_t *task = arg;
+	current_task = task;
+	task->func(task->arg);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+	(void)name;
+	(void)stack;
+	(void)priority;
+	MOCK_TASK_t *task = calloc(1, sizeof(MOCK_TASK_t));
+	pthread_mutex_init(&task->lock, NULL);
+	pthread_cond_init(&task->cond, NULL);
+	task->func = func;
+	task->arg = arg;
+	task->core = (core == tskNO_AFFINITY) ? 0 : core;
+	if (handle) *handle = task;
+	pthread_create(&task->thread, NULL, taskEntry, task);
+	pthread_detach(task->thread);
+	return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+	return xTaskCreatePinnedToCore(func, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return current_task;
+}
+
+BaseType_t xPortGetCoreID(void) {
+	return current_task->core;
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+	if (handle == NULL) pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+	(void)ticks;
+	sched_yield();
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return esp_timer_get_time() / (portTICK_PERIOD_MS * 1000);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+	(void)wait;
+	MOCK_TASK_t *task = current_task;
+	pthread_mutex_lock(&task->lock);
+	while (task->notify == 0) pthread_cond_wait(&task->cond, &task->lock);
+	uint32_t value = task->notify;
+	if (clear) task->notify = 0;
+	else task->notify--;
+	pthread_mutex_unlock(&task->lock);
+	return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+	MOCK_TASK_t *task = handle;
+	pthread_mutex_lock(&task->lock);
+	task->notify++;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+	return pdPASS;
+}
+
+//
+// Semaphores
+//
+struct mock_sem {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int count;
+	int max;
+};
+
+static SemaphoreHandle_t semaphoreCreate(int count, int max) {
+	SemaphoreHandle_t sem = calloc(1, sizeof(struct mock_sem));
+	pthread_mutex_init(&sem->lock, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->count = count;
+	sem->max = max;
+	return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+	return semaphoreCreate(0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	return semaphoreCreate(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+	pthread_mutex_lock(&sem->lock);
+	if (wait == 0 && sem->count == 0) {
+		pthread_mutex_unlock(&sem->lock);
+		return pdFALSE;
+	}
+	while (sem->count == 0) pthread_cond_wait(&sem->cond, &sem->lock);
+	sem->count--;
+	pthread_mutex_unlock(&sem->lock);
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+	pthread_mutex_lock(&sem->lock);
+	if (sem->count < sem->max) sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->lock);
+	return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+	free(sem);
+}
+
+//
+// GPIO
+//
+static int gpio_level[64];
+
+esp_err_t gpio_reset_pin(gpio_num_t pin) {
+	(void)pin;
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode) {
+	(void)pin;
+	(void)mode;
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+	gpio_level[pin] = level;
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin) {
+	return gpio_level[pin];
+}
+
+//
+// ST7789 panel
+//
+static struct {
+	uint8_t cmd;
+	int nparam;
+	uint8_t param[8];
+	int xs, xe, ys, ye;	// address window
+	int cx, cy;	// write position
+	uint8_t madctl;
+	uint8_t colmod;
+	int tfa, vsa, bfa, vsp;	// vertical scrolling
+	uint32_t acc;	// pixel bits not consumed yet
+	int accbits;
+	int last_dc;
+} panel = {
+	.colmod = 0x66,
+	.xe = MOCK_GRAM_WIDTH-1,
+	.ye = MOCK_GRAM_HEIGHT-1,
+	.vsa = MOCK_GRAM_HEIGHT,
+	.last_dc = -1,
+};
+
+// Store one pixel at the write position and advance it
+// MADCTL MV exchanges the address counters, MX and MY mirror them.
+static void panelPixel(uint16_t color) {
+	int x = panel.cx;
+	int y = panel.cy;
+	if (panel.madctl & 0x20) {
+		x = panel.cy;
+		y = panel.cx;
+	}
+	if (panel.madctl & 0x40) x = MOCK_GRAM_WIDTH - 1 - x;
+	if (panel.madctl & 0x80) y = MOCK_GRAM_HEIGHT - 1 - y;
+	if (x >= 0 && x < MOCK_GRAM_WIDTH && y >= 0 && y < MOCK_GRAM_HEIGHT) {
+		mock_gram[y][x] = color;
+	} else {
+		mock_stats.out_of_gram++;
+	}
+	mock_stats.pixels++;
+	if (++panel.cx > panel.xe) {
+		panel.cx = panel.xs;
+		if (++panel.cy > panel.ye) panel.cy = panel.ys;
+	}
+}
+
+// RGB444 to RGB565, replicating the high bits
+static uint16_t expandRGB444(uint16_t pixel) {
+	uint16_t r = (pixel >> 8) & 0xF;
+	uint16_t g = (pixel >> 4) & 0xF;
+	uint16_t b = pixel & 0xF;
+	return (r << 12) | ((r >> 3) << 11) | (g << 7) | ((g >> 2) << 5) | (b << 1) | (b >> 3);
+}
+
+static void panelByte(int dc, uint8_t data) {
+	if (dc == 0) {
+		panel.cmd = data;
+		panel.nparam = 0;
+		panel.acc = 0;
+		panel.accbits = 0;
+		mock_stats.commands++;
+		mock_stats.cmd_count[data]++;
+		if (data == 0x2C) {	// Memory Write
+			panel.cx = panel.xs;
+			panel.cy = panel.ys;
+		}
+		if (data == 0x01) {	// Software Reset
+			panel.madctl = 0;
+			panel.colmod = 0x66;
+		}
+		return;
+	}
+
+	if (panel.cmd == 0x2C || panel.cmd == 0x3C) {
+		// Pixel data, a partial pixel is dropped at the next command
+		panel.acc = (panel.acc << 8) | data;
+		panel.accbits += 8;
+		if ((panel.colmod & 0x07) == 0x03) {
+			while (panel.accbits >= 12) {
+				panel.accbits -= 12;
+				panelPixel(expandRGB444((panel.acc >> panel.accbits) & 0xFFF));
+			}
+		} else if (panel.accbits == 16) {
+			panelPixel(panel.acc & 0xFFFF);
+			panel.acc = 0;
+			panel.accbits = 0;
+		}
+		return;
+	}
+
+	if (panel.nparam < sizeof(panel.param)) panel.param[panel.nparam] = data;
+	panel.nparam++;
+	uint8_t *p = panel.param;
+	switch (panel.cmd) {
+	case 0x2A:	// Column Address Set
+		if (panel.nparam == 4) {
+			panel.xs = p[0] << 8 | p[1];
+			panel.xe = p[2] << 8 | p[3];
+		}
+		break;
+	case 0x2B:	// Row Address Set
+		if (panel.nparam == 4) {
+			panel.ys = p[0] << 8 | p[1];
+			panel.ye = p[2] << 8 | p[3];
+		}
+		break;
+	case 0x33:	// Vertical Scrolling Definition
+		if (panel.nparam == 6) {
+			panel.tfa = p[0] << 8 | p[1];
+			panel.vsa = p[2] << 8 | p[3];
+			panel.bfa = p[4] << 8 | p[5];
+		}
+		break;
+	case 0x36:	// Memory Data Access Control
+		panel.madctl = data;
+		break;
+	case 0x37:	// Vertical Scroll Start Address
+		if (panel.nparam == 2) panel.vsp = p[0] << 8 | p[1];
+		break;
+	case 0x3A:	// Interface Pixel Format
+		panel.colmod = data;
+		break;
+	}
+}
+
+// GRAM pixel shown at memory position x,y after vertical scrolling
+uint16_t mock_panel_visible(int x, int y) {
+	if (y >= panel.tfa && y < panel.tfa + panel.vsa) {
+		int offset = panel.vsp - panel.tfa;
+		y = panel.tfa + ((y - panel.tfa + offset) % panel.vsa + panel.vsa) % panel.vsa;
+	}
+	return mock_gram[y][x];
+}
+
+uint8_t mock_panel_madctl(void) {
+	return panel.madctl;
+}
+
+uint8_t mock_panel_colmod(void) {
+	return panel.colmod;
+}
+
+// Save the visible GRAM area x,y,w,h as a binary PPM
+bool mock_write_ppm(const char *path, int x, int y, int w, int h) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) return false;
+	fprintf(f, "P6 %d %d 255\n", w, h);
+	for (int j=y;j<y+h;j++) {
+		for (int i=x;i<x+w;i++) {
+			uint16_t c = mock_panel_visible(i, j);
+			fputc((c >> 11) << 3, f);
+			fputc(((c >> 5) & 0x3F) << 2, f);
+			fputc((c & 0x1F) << 3, f);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+//
+// SPI master
+//
+struct spi_device_t {
+	spi_device_interface_config_t cfg;
+	spi_transaction_t *pending[64];
+	int npending;
+	spi_transaction_t *done[64];
+	int ndone;
+	bool acquired;
+};
+
+static struct spi_device_t spi_device;
+static int max_transfer_sz = 4092;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma) {
+	(void)host;
+	(void)dma;
+	if (cfg->max_transfer_sz > 0) max_transfer_sz = cfg->max_transfer_sz;
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle) {
+	(void)host;
+	spi_device.cfg = *cfg;
+	*handle = &spi_device;
+	return ESP_OK;
+}
+
+// Clock one transaction out to the panel
+static void spiExecute(spi_device_handle_t handle, spi_transaction_t *t) {
+	if (handle->cfg.pre_cb) handle->cfg.pre_cb(t);
+	int dc = gpio_level[mock_dc_gpio];
+	if (dc != panel.last_dc) {
+		mock_stats.dc_toggles++;
+		panel.last_dc = dc;
+	}
+
+	assert(t->length % 8 == 0);
+	size_t length = t->length / 8;
+	if (length > max_transfer_sz) {
+		fprintf(stderr, "transfer of %zu bytes exceeds max_transfer_sz %d\n", length, max_transfer_sz);
+		abort();
+	}
+	const uint8_t *data = t->tx_buffer;
+	if (t->flags & SPI_TRANS_USE_TXDATA) {
+		assert(length <= 4);
+		data = t->tx_data;
+	}
+	for (size_t i=0;i<length;i++) {
+		panelByte(dc, data[i]);
+	}
+
+	mock_stats.transactions++;
+	mock_stats.bytes += length;
+	mock_stats.bus_ns += (uint64_t)length * 8 * 1000000000ULL / handle->cfg.clock_speed_hz + TRANS_OVERHEAD_NS;
+	if (handle->cfg.post_cb) handle->cfg.post_cb(t);
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *t) {
+	pthread_mutex_lock(&spi_lock);
+	assert(handle->npending == 0 && handle->ndone == 0);
+	spiExecute(handle, t);
+	mock_stats.interrupt_trans++;
+	pthread_mutex_unlock(&spi_lock);
+	return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *t) {
+	pthread_mutex_lock(&spi_lock);
+	// The real driver refuses to poll while queued transactions are outstanding
+	assert(handle->npending == 0 && handle->ndone == 0);
+	spiExecute(handle, t);
+	mock_stats.polling_trans++;
+	pthread_mutex_unlock(&spi_lock);
+	return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *t, TickType_t wait) {
+	(void)wait;
+	pthread_mutex_lock(&spi_lock);
+	if (handle->npending + handle->ndone >= handle->cfg.queue_size) {
+		fprintf(stderr, "queue_size %d exceeded\n", handle->cfg.queue_size);
+		abort();
+	}
+	handle->pending[handle->npending++] = t;
+	mock_stats.queued_trans++;
+	pthread_mutex_unlock(&spi_lock);
+	return ESP_OK;
+}
+
+// Transactions are only executed when their result is collected, one at a
+// time, so a caller that reuses a buffer too early sends the wrong data.
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **t, TickType_t wait) {
+	(void)wait;
+	pthread_mutex_lock(&spi_lock);
+	if (handle->ndone == 0) {
+		if (handle->npending == 0) {
+			fprintf(stderr, "spi_device_get_trans_result with nothing queued\n");
+			abort();
+		}
+		spiExecute(handle, handle->pending[0]);
+		handle->done[handle->ndone++] = handle->pending[0];
+		memmove(handle->pending, handle->pending+1, (handle->npending-1) * sizeof(handle->pending[0]));
+		handle->npending--;
+	}
+	*t = handle->done[0];
+	memmove(handle->done, handle->done+1, (handle->ndone-1) * sizeof(handle->done[0]));
+	handle->ndone--;
+	pthread_mutex_unlock(&spi_lock);
+	return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t wait) {
+	(void)wait;
+	assert(!handle->acquired);
+	handle->acquired = true;
+	mock_stats.acquires++;
+	return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t handle) {
+	assert(handle->acquired);
+	handle->acquired = false;
+}
+
+int mock_spi_inflight(void) {
+	return spi_device.npending + spi_device.ndone;
+}
+
+void mock_reset_stats(void) {
+	memset(&mock_stats, 0, sizeof(mock_stats));
+}
@@ -0,0 +1,39 @@
+#ifndef MAIN_MOCK_H_
+#define MAIN_MOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Size of the emulated controller memory
+#define MOCK_GRAM_WIDTH 240
+#define MOCK_GRAM_HEIGHT 320
+
+// Traffic seen by the emulated panel
+typedef struct {
+	uint64_t transactions;
+	uint64_t bytes;
+	uint64_t commands;
+	uint64_t pixels;
+	uint64_t dc_toggles;	// DC level changes between transactions
+	uint64_t polling_trans;
+	uint64_t queued_trans;
+	uint64_t interrupt_trans;
+	uint64_t acquires;
+	uint64_t out_of_gram;	// pixels written outside the controller memory
+	uint64_t bus_ns;	// estimated wire time at the configured clock
+	uint64_t cmd_count[256];
+} MOCK_STATS_t;
+
+extern MOCK_STATS_t mock_stats;
+extern int mock_log_level;
+extern int mock_dc_gpio;
+extern uint16_t mock_gram[MOCK_GRAM_HEIGHT][MOCK_GRAM_WIDTH];
+
+void mock_reset_stats(void);
+uint16_t mock_panel_visible(int x, int y);
+uint8_t mock_panel_madctl(void);
+uint8_t mock_panel_colmod(void);
+int mock_spi_inflight(void);
+bool mock_write_ppm(const char *path, int x, int y, int w, int h);
+void mock_set_partition(const char *label, const void *data, size_t size);
+#endif /* MAIN_MOCK_H_ */
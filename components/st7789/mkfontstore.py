@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+#
+# Pack FONTX files into a font store image for a raw data partition,
+# the layout is described in fontstore.h
+#
+# usage: mkfontstore.py output.bin font.FNT...
+#
+import os
+import struct
+import sys
+
+MAGIC = b'FNTS'
+NAME_SIZE = 16
+ENTRY_SIZE = NAME_SIZE + 8
+
+
+def align(n):
+    return (n + 3) & ~3
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit('usage: mkfontstore.py output.bin font.FNT...')
+    output, paths = sys.argv[1], sys.argv[2:]
+
+    fonts = []
+    for path in sorted(paths, key=os.path.basename):
+        name = os.path.basename(path).encode()
+        if len(name) > NAME_SIZE:
+            sys.exit('%s: name longer than %d bytes' % (path, NAME_SIZE))
+        with open(path, 'rb') as f:
+            fonts.append((name, f.read()))
+
+    offset = align(8 + ENTRY_SIZE * len(fonts))
+    header = MAGIC + struct.pack('<I', len(fonts))
+    entries = b''
+    data = b''
+    for name, font in fonts:
+        entries += name.ljust(NAME_SIZE, b'\0') + struct.pack('<II', offset + len(data), len(font))
+        data += font.ljust(align(len(font)), b'\xff')
+
+    image = (header + entries).ljust(offset, b'\xff') + data
+    with open(output, 'wb') as f:
+        f.write(image)
+
+
+if __name__ == '__main__':
+    main()
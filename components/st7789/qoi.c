@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "st7789.h"
+#include "qoi.h"
+
+#define TAG "QOI"
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF  0x40 // 01xxxxxx
+#define QOI_OP_LUMA  0x80 // 10xxxxxx
+#define QOI_OP_RUN   0xc0 // 11xxxxxx
+#define QOI_OP_RGB   0xfe // 11111110
+#define QOI_OP_RGBA  0xff // 11111111
+#define QOI_MASK_2   0xc0 // 11000000
+
+#define QOI_HEADER_SIZE 14
+#define QOI_READ_SIZE 64 // bytes read from the file at a time
+
+typedef struct {
+	uint8_t r, g, b, a;
+} QOI_RGBA_t;
+
+// Decoder state
+typedef struct {
+	FILE *file;
+	uint32_t width;
+	uint32_t height;
+	uint8_t buf[QOI_READ_SIZE];
+	uint8_t pos;
+	uint8_t len;
+	bool eof;
+	uint8_t run;
+	QOI_RGBA_t px;
+	QOI_RGBA_t index[64];
+} QOI_t;
+
+// Next byte of the file
+// Reading past the end returns 0 and sets eof.
+static inline uint8_t qoiByte(QOI_t * q) {
+	if (q->pos == q->len) {
+		q->len = fread(q->buf, 1, sizeof(q->buf), q->file);
+		q->pos = 0;
+		if (q->len == 0) {
+			q->eof = true;
+			return 0;
+		}
+	}
+	return q->buf[q->pos++];
+}
+
+// Open a file and read its header
+static bool qoiOpen(QOI_t * q, const char *path) {
+	memset(q, 0, sizeof(QOI_t));
+	q->file = fopen(path, "r");
+	if (q->file == NULL) {
+		ESP_LOGE(TAG, "%s not found", path);
+		return false;
+	}
+	// Reads go through buf, the stdio buffer would only be a second copy
+	setvbuf(q->file, NULL, _IONBF, 0);
+
+	uint8_t header[QOI_HEADER_SIZE];
+	for (int i=0;i<QOI_HEADER_SIZE;i++) {
+		header[i] = qoiByte(q);
+	}
+	q->width = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+	q->height = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+	if (q->eof || memcmp(header, "qoif", 4) != 0 || q->width == 0 || q->height == 0
+		|| q->width > UINT16_MAX || q->height > UINT16_MAX) {
+		ESP_LOGE(TAG, "%s not QOI format", path);
+		fclose(q->file);
+		q->file = NULL;
+		return false;
+	}
+	q->px.a = 255;
+	return true;
+}
+
+// Decode the next pixel into q->px
+static inline void qoiNext(QOI_t * q) {
+	if (q->run > 0) {
+		q->run--;
+		return;
+	}
+
+	uint8_t b1 = qoiByte(q);
+	if (b1 == QOI_OP_RGB) {
+		q->px.r = qoiByte(q);
+		q->px.g = qoiByte(q);
+		q->px.b = qoiByte(q);
+	} else if (b1 == QOI_OP_RGBA) {
+		q->px.r = qoiByte(q);
+		q->px.g = qoiByte(q);
+		q->px.b = qoiByte(q);
+		q->px.a = qoiByte(q);
+	} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+		q->px = q->index[b1];
+	} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+		q->px.r += ((b1 >> 4) & 0x03) - 2;
+		q->px.g += ((b1 >> 2) & 0x03) - 2;
+		q->px.b += (b1 & 0x03) - 2;
+	} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		uint8_t b2 = qoiByte(q);
+		int vg = (b1 & 0x3f) - 32;
+		q->px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+		q->px.g += vg;
+		q->px.b += vg - 8 + (b2 & 0x0f);
+	} else {
+		q->run = b1 & 0x3f;
+	}
+	q->index[(q->px.r*3 + q->px.g*5 + q->px.b*7 + q->px.a*11) % 64] = q->px;
+}
+
+// Get the size of a QOI image
+// width:Image width
+// height:Image height
+bool qoiGetSize(const char *path, uint16_t *width, uint16_t *height) {
+	QOI_t q;
+	if (!qoiOpen(&q, path)) return false;
+	*width = q.width;
+	*height = q.height;
+	fclose(q.file);
+	return true;
+}
+
+// Draw QOI image from file
+// path:Image file, e.g. on the /fonts SPIFFS partition
+// x:Left of the image
+// y:Top of the image
+// Rows are sent as they are decoded. With a band buffer the file is read
+// up to the last row of the current band only.
+bool qoiDraw(TFT_t * dev, const char *path, int16_t x, int16_t y) {
+	QOI_t q;
+	if (!qoiOpen(&q, path)) return false;
+
+	// Visible columns and the rows that have to be decoded
+	int cx1 = (x < 0) ? -x : 0;
+	int cx2 = (x + (int)q.width > dev->_width) ? dev->_width - x : q.width;
+	int rows = (y + (int)q.height > dev->_band_y + dev->_band_height) ? dev->_band_y + dev->_band_height - y : q.height;
+	bool ok = true;
+
+	if (cx1 < cx2 && rows > 0) {
+		int cols = cx2 - cx1;
+		uint8_t *row = (uint8_t *)malloc(cols*2);
+		if (row == NULL) {
+			ESP_LOGE(TAG, "Error allocating memory for a row of %d pixels", cols);
+			fclose(q.file);
+			return false;
+		}
+		IMAGE_t image = {
+			.format = PIXEL_RGB565_BE,
+			.data = row,
+		};
+
+		for (int j=0;j<rows;j++) {
+			int i = 0;
+			for (;i<cx1;i++) qoiNext(&q);
+			for (uint8_t *dst=row;i<cx2;i++,dst+=2) {
+				qoiNext(&q);
+				uint16_t color = rgb565(q.px.r, q.px.g, q.px.b);
+				dst[0] = color >> 8;
+				dst[1] = color & 0xFF;
+			}
+			for (;i<q.width;i++) qoiNext(&q);
+			if (q.eof) {
+				ESP_LOGE(TAG, "%s truncated at row %d", path, j);
+				ok = false;
+				break;
+			}
+			if (y+j >= dev->_band_y) lcdBlitImage(dev, x+cx1, y+j, &image, 0, 0, cols, 1);
+		}
+		free(row);
+	}
+	fclose(q.file);
+	return ok;
+}
@@ -0,0 +1,12 @@
+#ifndef MAIN_QOI_H_
+#define MAIN_QOI_H_
+
+#include "st7789.h"
+
+// Streaming decoder for QOI images, https://qoiformat.org
+// Images are decoded one row at a time, so only the visible part of a
+// row and a small read buffer are held in memory. Alpha is ignored.
+
+bool qoiGetSize(const char *path, uint16_t *width, uint16_t *height);
+bool qoiDraw(TFT_t * dev, const char *path, int16_t x, int16_t y);
+#endif /* MAIN_QOI_H_ */
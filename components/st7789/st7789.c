@@ -1,6 +1,5 @@
 #include <string.h>
 #include <inttypes.h>
-#include <math.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -8,8 +7,10 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include "esp_log.h"
+#include "esp_attr.h"
 
 #include "st7789.h"
+#include "glyphcache.h"
 
 #define TAG "ST7789"
 #define	_DEBUG_ 0
@@ -37,6 +38,45 @@ void spi_clock_speed(int speed) {
 	clock_speed_hz = speed;
 }
 
+// Drive DC from the SPI driver right before each transaction is clocked out
+// The GPIO number and the level are packed into the user field of the transaction.
+// Transactions without user data (spi_master_write_byte) leave DC alone.
+#define SPI_DC_USER(gpio, level) ((void *)(intptr_t)(((gpio) << 2) | 0x02 | (level)))
+
+// The frame buffer holds RGB565 in panel (big-endian) byte order, see SWAP16,
+// so it can be sent to the panel as it is in RGB565 mode.
+
+#if CONFIG_COLOR_RGB444
+#define COLMOD_VALUE 0x53
+#define PIXEL_BYTES(count) (((count)*3+1)/2) // bytes on the wire for count pixels
+#define PIXEL_BUFFER_SIZE (SPI_BUFFER_SIZE/3*3) // whole pixel pairs per transaction buffer
+#define FILL_PATTERN_SIZE 12 // four pixels, a whole number of words
+#else
+#define COLMOD_VALUE 0x55
+#define PIXEL_BYTES(count) ((count)*2)
+#define PIXEL_BUFFER_SIZE SPI_BUFFER_SIZE
+#define FILL_PATTERN_SIZE 4
+#endif
+// Bytes of the fill pattern sent per transaction
+#define FILL_CHUNK_SIZE (SPI_FILL_BUFFER_SIZE/FILL_PATTERN_SIZE*FILL_PATTERN_SIZE)
+
+// Pixels written into the transaction buffers
+// See spi_master_stream_pixels()
+typedef struct {
+	uint8_t *data;
+	uint32_t index;
+#if CONFIG_COLOR_RGB444
+	uint16_t pending; // RGB444 pixel waiting for the second pixel of its pair
+	bool has_pending;
+#endif
+} PIXEL_STREAM_t;
+
+static void IRAM_ATTR spi_master_pre_transfer_callback(spi_transaction_t *t)
+{
+	int user = (int)(intptr_t)t->user;
+	if (user & 0x02) gpio_set_level( user >> 2, user & 0x01 );
+}
+
 void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO_RESET, int16_t GPIO_BL)
 {
 	esp_err_t ret;
@@ -84,7 +124,7 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 		.sclk_io_num = GPIO_SCLK,
 		.quadwp_io_num = -1,
 		.quadhd_io_num = -1,
-		.max_transfer_sz = 0,
+		.max_transfer_sz = SPI_MAX_TRANSFER_SIZE,
 		.flags = 0
 	};
 
@@ -96,10 +136,11 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 	memset(&devcfg, 0, sizeof(devcfg));
 	//devcfg.clock_speed_hz = SPI_Frequency;
 	devcfg.clock_speed_hz = clock_speed_hz;
-	devcfg.queue_size = 7;
+	devcfg.queue_size = SPI_QUEUE_SIZE;
 	//devcfg.mode = 2;
 	devcfg.mode = 3;
 	devcfg.flags = SPI_DEVICE_NO_DUMMY;
+	devcfg.pre_cb = spi_master_pre_transfer_callback;
 
 	if ( GPIO_CS >= 0 ) {
 		devcfg.spics_io_num = GPIO_CS;
@@ -114,6 +155,26 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 	dev->_dc = GPIO_DC;
 	dev->_bl = GPIO_BL;
 	dev->_SPIHandle = handle;
+
+	// Transaction ring. All buffers come from one DMA capable block.
+	uint8_t *buffer = heap_caps_malloc(SPI_QUEUE_SIZE*SPI_BUFFER_SIZE + SPI_FILL_BUFFER_SIZE, MALLOC_CAP_DMA);
+	assert(buffer != NULL);
+	for (int i=0;i<SPI_QUEUE_SIZE;i++) {
+		dev->_trans_buffer[i] = buffer + i*SPI_BUFFER_SIZE;
+	}
+	dev->_fill_buffer = buffer + SPI_QUEUE_SIZE*SPI_BUFFER_SIZE;
+	dev->_fill_color = 0;
+	dev->_fill_length = 0;
+	dev->_fill_mark = 0;
+	dev->_trans_head = 0;
+	dev->_trans_pending = 0;
+	dev->_async = false;
+	dev->_batch = 0;
+	dev->_polling_threshold = SPI_POLLING_THRESHOLD;
+	dev->_trans_count = 0;
+	dev->_trans_done = 0;
+	dev->_byte_count = 0;
+	dev->_window_valid = false;
 }
 
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength)
@@ -136,66 +197,371 @@ bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, s
 	return true;
 }
 
+// Wait for the oldest queued transaction to complete
+static void spi_master_wait_one(TFT_t * dev)
+{
+	spi_transaction_t *SPITransaction;
+	esp_err_t ret;
+
+	ret = spi_device_get_trans_result( dev->_SPIHandle, &SPITransaction, portMAX_DELAY );
+	assert(ret==ESP_OK);
+	dev->_trans_pending--;
+	dev->_trans_done++;
+}
+
+// Wait until every queued transaction has been sent
+void spi_master_fence(TFT_t * dev)
+{
+	while (dev->_trans_pending > 0) {
+		spi_master_wait_one(dev);
+	}
+}
+
+// Wait until the first count transactions ever issued have been sent
+// Compare with _trans_count taken right after queuing a transfer.
+static void spi_master_wait_until(TFT_t * dev, uint32_t count)
+{
+	while (dev->_trans_pending > 0 && (int32_t)(dev->_trans_done - count) < 0) {
+		spi_master_wait_one(dev);
+	}
+}
+
+// Enable/Disable queued transfers
+// When enabled the write functions return as soon as the transaction is queued.
+// Call spi_master_fence() when the data has to be on the panel.
+void spi_master_set_async(TFT_t * dev, bool enable)
+{
+	if (!enable) spi_master_fence(dev);
+	dev->_async = enable;
+}
+
+// Start a draw batch
+// The bus stays acquired until the matching lcdEndBatch(), and short
+// transactions (commands, addresses, single pixels) are sent by polling.
+// Batches may be nested.
+void lcdBeginBatch(TFT_t * dev)
+{
+	esp_err_t ret;
+
+	// Drawing into a frame buffer does not touch the bus
+	if (dev->_use_frame_buffer) return;
+	if (dev->_batch++ > 0) return;
+	spi_master_fence(dev);
+	ret = spi_device_acquire_bus( dev->_SPIHandle, portMAX_DELAY );
+	assert(ret==ESP_OK);
+}
+
+// End a draw batch
+void lcdEndBatch(TFT_t * dev)
+{
+	if (dev->_use_frame_buffer) return;
+	if (dev->_batch == 0) return;
+	if (--dev->_batch > 0) return;
+	spi_master_fence(dev);
+	spi_device_release_bus( dev->_SPIHandle );
+}
+
+// Get the next free transaction slot
+// Blocks while the slot is still owned by the SPI driver.
+static spi_transaction_t *spi_master_get_trans(TFT_t * dev)
+{
+	if (dev->_trans_pending == SPI_QUEUE_SIZE) spi_master_wait_one(dev);
+	spi_transaction_t *SPITransaction = &dev->_trans[dev->_trans_head];
+	memset( SPITransaction, 0, sizeof( spi_transaction_t ) );
+	return SPITransaction;
+}
+
+// Get the data area of the next free transaction slot
+// Up to 4 bytes are carried inside the transaction itself, larger payloads use the DMA buffer of the slot.
+static uint8_t *spi_master_get_data(TFT_t * dev, size_t DataLength)
+{
+	spi_transaction_t *SPITransaction = spi_master_get_trans(dev);
+	if (DataLength <= 4) {
+		SPITransaction->flags = SPI_TRANS_USE_TXDATA;
+		return SPITransaction->tx_data;
+	}
+	SPITransaction->tx_buffer = dev->_trans_buffer[dev->_trans_head];
+	return dev->_trans_buffer[dev->_trans_head];
+}
+
+// Queue the slot prepared by spi_master_get_data()
+// Inside a batch short transfers are polled instead, which avoids the interrupt round trip.
+static void spi_master_queue_data(TFT_t * dev, int dc, size_t DataLength)
+{
+	spi_transaction_t *SPITransaction = &dev->_trans[dev->_trans_head];
+	esp_err_t ret;
+
+	SPITransaction->length = DataLength * 8;
+	SPITransaction->user = SPI_DC_USER(dev->_dc, dc);
+	dev->_trans_count++;
+	dev->_byte_count += DataLength;
+	if (dev->_batch > 0 && DataLength <= dev->_polling_threshold) {
+		// Polling is not allowed while queued transactions are outstanding
+		spi_master_fence(dev);
+		ret = spi_device_polling_transmit( dev->_SPIHandle, SPITransaction );
+		assert(ret==ESP_OK);
+		dev->_trans_done++;
+	} else {
+		ret = spi_device_queue_trans( dev->_SPIHandle, SPITransaction, portMAX_DELAY );
+		assert(ret==ESP_OK);
+		dev->_trans_pending++;
+	}
+	dev->_trans_head = (dev->_trans_head + 1) % SPI_QUEUE_SIZE;
+}
+
+// Send the slot prepared by spi_master_get_data()
+// Waits for completion unless the transport is asynchronous.
+static bool spi_master_send_data(TFT_t * dev, int dc, size_t DataLength)
+{
+	spi_master_queue_data(dev, dc, DataLength);
+	if (!dev->_async) spi_master_fence(dev);
+	return true;
+}
+
+#if !CONFIG_COLOR_RGB444
+// Queue data straight from a DMA capable caller buffer
+// The buffer must stay untouched until the transactions have been sent.
+// RGB444 pixels are always packed into the transaction buffers instead.
+static void spi_master_queue_buffer(TFT_t * dev, int dc, const uint8_t *Data, size_t DataLength)
+{
+	while (DataLength > 0) {
+		size_t bs = (DataLength > SPI_MAX_TRANSFER_SIZE) ? SPI_MAX_TRANSFER_SIZE : DataLength;
+		spi_transaction_t *SPITransaction = spi_master_get_trans(dev);
+		SPITransaction->tx_buffer = Data;
+		spi_master_queue_data(dev, dc, bs);
+		DataLength -= bs;
+		Data += bs;
+	}
+}
+#endif
+
+#if CONFIG_COLOR_RGB444
+// RGB565 to RGB444, the low bits of each channel are dropped
+static inline uint16_t rgb444(uint16_t color)
+{
+	return ((color >> 4) & 0xF00) | ((color >> 3) & 0x0F0) | ((color >> 1) & 0x00F);
+}
+
+// Pack two RGB444 pixels into three bytes
+static inline void packRGB444(uint8_t *dst, uint16_t p0, uint16_t p1)
+{
+	dst[0] = p0 >> 4;
+	dst[1] = (p0 << 4) | (p1 >> 8);
+	dst[2] = p1;
+}
+#endif
+
+// Append count pixels to a stream of transaction buffers
+// swap:Pixels are in panel byte order (frame buffer) instead of CPU order
+// Full buffers are queued as they fill up, spi_master_stream_end() queues the rest.
+static void spi_master_stream_pixels(TFT_t * dev, PIXEL_STREAM_t *s, const uint16_t *pixels, uint32_t count, bool swap)
+{
+	while (count > 0) {
+		if (s->data == NULL) {
+			s->data = spi_master_get_data(dev, PIXEL_BUFFER_SIZE);
+			s->index = 0;
+		}
+		uint8_t *dst = s->data + s->index;
+		uint32_t n = 0;
+#if CONFIG_COLOR_RGB444
+		uint32_t pairs = (PIXEL_BUFFER_SIZE - s->index) / 3;
+		if (s->has_pending) {
+			uint16_t c = swap ? SWAP16(pixels[0]) : pixels[0];
+			packRGB444(dst, s->pending, rgb444(c));
+			s->has_pending = false;
+			dst += 3;
+			pairs--;
+			n = 1;
+		}
+		for (;pairs > 0 && n+1 < count;pairs--) {
+			uint16_t c0 = pixels[n++];
+			uint16_t c1 = pixels[n++];
+			if (swap) {
+				c0 = SWAP16(c0);
+				c1 = SWAP16(c1);
+			}
+			packRGB444(dst, rgb444(c0), rgb444(c1));
+			dst += 3;
+		}
+		if (pairs > 0 && n < count) {
+			// The last pixel is paired with the first one of the next call
+			uint16_t c = pixels[n++];
+			s->pending = rgb444(swap ? SWAP16(c) : c);
+			s->has_pending = true;
+		}
+#else
+		n = (PIXEL_BUFFER_SIZE - s->index) / 2;
+		if (n > count) n = count;
+		if (swap) {
+			memcpy(dst, pixels, n*2);
+			dst += n*2;
+		} else {
+			for (uint32_t i=0;i<n;i++) {
+				*dst++ = (pixels[i] >> 8) & 0xFF;
+				*dst++ = pixels[i] & 0xFF;
+			}
+		}
+#endif
+		s->index = dst - s->data;
+		pixels += n;
+		count -= n;
+		if (s->index == PIXEL_BUFFER_SIZE) {
+			spi_master_queue_data(dev, SPI_Data_Mode, s->index);
+			s->data = NULL;
+		}
+	}
+}
+
+// Queue what is left in a pixel stream
+static void spi_master_stream_end(TFT_t * dev, PIXEL_STREAM_t *s)
+{
+#if CONFIG_COLOR_RGB444
+	if (s->has_pending) {
+		// Half a pair, the panel drops the unused bits
+		s->data[s->index++] = s->pending >> 4;
+		s->data[s->index++] = s->pending << 4;
+		s->has_pending = false;
+	}
+#endif
+	if (s->data != NULL) {
+		spi_master_queue_data(dev, SPI_Data_Mode, s->index);
+		s->data = NULL;
+	}
+}
+
+// Queue pixels in panel byte order from a DMA capable buffer
+// RGB565 is sent straight from the buffer, so it must stay untouched until sent.
+// RGB444 is packed into the transaction buffers.
+static void spi_master_queue_pixels(TFT_t * dev, const uint16_t *pixels, uint32_t count)
+{
+#if CONFIG_COLOR_RGB444
+	PIXEL_STREAM_t stream = {0};
+	spi_master_stream_pixels(dev, &stream, pixels, count, true);
+	spi_master_stream_end(dev, &stream);
+#else
+	spi_master_queue_buffer(dev, SPI_Data_Mode, (const uint8_t *)pixels, count*2);
+#endif
+}
+
+// Queue size pixels of one color
+// All transactions point at the same pattern buffer, which is only
+// refilled when the color changes.
+static void spi_master_queue_fill(TFT_t * dev, uint16_t color, uint32_t size)
+{
+	uint32_t bytes = PIXEL_BYTES(size);
+	if (bytes <= 4) {
+		// Fits in the transaction itself
+		uint8_t *Byte = spi_master_get_data(dev, bytes);
+#if CONFIG_COLOR_RGB444
+		uint16_t pixel = rgb444(color);
+		packRGB444(Byte, pixel, pixel);
+#else
+		for(int i=0;i<bytes;i+=2) {
+			Byte[i] = (color >> 8) & 0xFF;
+			Byte[i+1] = color & 0xFF;
+		}
+#endif
+		spi_master_queue_data(dev, SPI_Data_Mode, bytes);
+		return;
+	}
+	uint32_t need = (bytes > FILL_CHUNK_SIZE) ? FILL_CHUNK_SIZE : (bytes + FILL_PATTERN_SIZE-1) / FILL_PATTERN_SIZE * FILL_PATTERN_SIZE;
+	if (color != dev->_fill_color) {
+		// Earlier fills may still be reading the pattern
+		spi_master_wait_until(dev, dev->_fill_mark);
+		dev->_fill_color = color;
+		dev->_fill_length = 0;
+	}
+	if (need > dev->_fill_length) {
+		// The pattern in panel byte order, written a word at a time
+		uint32_t pattern[FILL_PATTERN_SIZE/4];
+#if CONFIG_COLOR_RGB444
+		uint16_t pixel = rgb444(color);
+		for (int i=0;i<FILL_PATTERN_SIZE;i+=3) {
+			packRGB444((uint8_t *)pattern + i, pixel, pixel);
+		}
+#else
+		pattern[0] = SWAP16(color) * 0x00010001u;
+#endif
+		uint32_t *word = (uint32_t *)dev->_fill_buffer;
+		for (uint32_t i=dev->_fill_length/4;i<need/4;i++) {
+			word[i] = pattern[i % (FILL_PATTERN_SIZE/4)];
+		}
+		dev->_fill_length = need;
+	}
+
+	while (bytes > 0) {
+		uint32_t bs = (bytes > FILL_CHUNK_SIZE) ? FILL_CHUNK_SIZE : bytes;
+		spi_transaction_t *SPITransaction = spi_master_get_trans(dev);
+		SPITransaction->tx_buffer = dev->_fill_buffer;
+		spi_master_queue_data(dev, SPI_Data_Mode, bs);
+		bytes -= bs;
+	}
+	dev->_fill_mark = dev->_trans_count;
+}
+
+// Queue a command with up to 4 bytes of parameters
+static void spi_master_queue_command(TFT_t * dev, uint8_t cmd, const uint8_t *param, size_t size)
+{
+	uint8_t *Byte = spi_master_get_data(dev, 1);
+	Byte[0] = cmd;
+	spi_master_queue_data(dev, SPI_Command_Mode, 1);
+	if (size > 0) {
+		Byte = spi_master_get_data(dev, size);
+		memcpy(Byte, param, size);
+		spi_master_queue_data(dev, SPI_Data_Mode, size);
+	}
+}
+
 bool spi_master_write_command(TFT_t * dev, uint8_t cmd)
 {
-	static uint8_t Byte = 0;
-	Byte = cmd;
-	gpio_set_level( dev->_dc, SPI_Command_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, &Byte, 1 );
+	// Raw commands may move the address window behind our back
+	dev->_window_valid = false;
+	uint8_t *Byte = spi_master_get_data(dev, 1);
+	Byte[0] = cmd;
+	return spi_master_send_data(dev, SPI_Command_Mode, 1);
 }
 
 bool spi_master_write_data_byte(TFT_t * dev, uint8_t data)
 {
-	static uint8_t Byte = 0;
-	Byte = data;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, &Byte, 1 );
+	uint8_t *Byte = spi_master_get_data(dev, 1);
+	Byte[0] = data;
+	return spi_master_send_data(dev, SPI_Data_Mode, 1);
 }
 
 
 bool spi_master_write_data_word(TFT_t * dev, uint16_t data)
 {
-	static uint8_t Byte[2];
+	uint8_t *Byte = spi_master_get_data(dev, 2);
 	Byte[0] = (data >> 8) & 0xFF;
 	Byte[1] = data & 0xFF;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, Byte, 2);
+	return spi_master_send_data(dev, SPI_Data_Mode, 2);
 }
 
 bool spi_master_write_addr(TFT_t * dev, uint16_t addr1, uint16_t addr2)
 {
-	static uint8_t Byte[4];
+	uint8_t *Byte = spi_master_get_data(dev, 4);
 	Byte[0] = (addr1 >> 8) & 0xFF;
 	Byte[1] = addr1 & 0xFF;
 	Byte[2] = (addr2 >> 8) & 0xFF;
 	Byte[3] = addr2 & 0xFF;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, Byte, 4);
+	return spi_master_send_data(dev, SPI_Data_Mode, 4);
 }
 
 bool spi_master_write_color(TFT_t * dev, uint16_t color, uint16_t size)
 {
-	static uint8_t Byte[1024];
-	int index = 0;
-	for(int i=0;i<size;i++) {
-		Byte[index++] = (color >> 8) & 0xFF;
-		Byte[index++] = color & 0xFF;
-	}
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, Byte, size*2);
+	spi_master_queue_fill(dev, color, size);
+	if (!dev->_async) spi_master_fence(dev);
+	return true;
 }
 
 // Add 202001
 bool spi_master_write_colors(TFT_t * dev, uint16_t * colors, uint16_t size)
 {
-	static uint8_t Byte[1024];
-	int index = 0;
-	for(int i=0;i<size;i++) {
-		Byte[index++] = (colors[i] >> 8) & 0xFF;
-		Byte[index++] = colors[i] & 0xFF;
-	}
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
-	return spi_master_write_byte( dev->_SPIHandle, Byte, size*2);
+	PIXEL_STREAM_t stream = {0};
+	spi_master_stream_pixels(dev, &stream, colors, size, false);
+	spi_master_stream_end(dev, &stream);
+	if (!dev->_async) spi_master_fence(dev);
+	return true;
 }
 
 void delayMS(int ms) {
@@ -206,12 +572,21 @@ void delayMS(int ms) {
 }
 
 
+#if CONFIG_DOUBLE_BUFFER
+static void lcdFlushTask(void *arg);
+#endif
+
 void lcdInit(TFT_t * dev, int width, int height, int offsetx, int offsety)
 {
 	dev->_width = width;
 	dev->_height = height;
 	dev->_offsetx = offsetx;
 	dev->_offsety = offsety;
+	dev->_rotation = DIRECTION0;
+	dev->_panel_width = width;
+	dev->_panel_height = height;
+	dev->_panel_offsetx = offsetx;
+	dev->_panel_offsety = offsety;
 	dev->_font_direction = DIRECTION0;
 	dev->_font_fill = false;
 	dev->_font_underline = false;
@@ -223,7 +598,7 @@ void lcdInit(TFT_t * dev, int width, int height, int offsetx, int offsety)
 	delayMS(255);
 	
 	spi_master_write_command(dev, 0x3A);	//Interface Pixel Format
-	spi_master_write_data_byte(dev, 0x55);
+	spi_master_write_data_byte(dev, COLMOD_VALUE);
 	delayMS(10);
 	
 	spi_master_write_command(dev, 0x36);	//Memory Data Access Control
@@ -254,22 +629,177 @@ void lcdInit(TFT_t * dev, int width, int height, int offsetx, int offsety)
 		gpio_set_level( dev->_bl, 1 );
 	}
 
+	dev->_scroll_top = 0;
+	dev->_scroll_height = 0;
+	dev->_scroll_offset = 0;
 	dev->_use_frame_buffer = false;
+	dev->_frame_buffer = NULL;
+	dev->_damage_count = 0;
+	dev->_band_y = 0;
+	dev->_band_height = height;
+	dev->_band_buffer[0] = NULL;
+	dev->_band_buffer[1] = NULL;
+#if CONFIG_BAND_BUFFER
+	// Two stripes: one is drawn while the other is on the wire
+	// Sized for the longer side so the display can be rotated
+	int band_width = (width > height) ? width : height;
+	for (int i=0;i<2;i++) {
+		dev->_band_buffer[i] = heap_caps_malloc(sizeof(uint16_t)*band_width*CONFIG_BAND_HEIGHT, MALLOC_CAP_DMA);
+		if (dev->_band_buffer[i] == NULL) {
+			ESP_LOGE(TAG, "heap_caps_malloc fail. Band buffer is not available.");
+			heap_caps_free(dev->_band_buffer[0]);
+			dev->_band_buffer[0] = NULL;
+			break;
+		}
+	}
+#endif
+	dev->_text_run = NULL;
+	dev->_text_run_size = 0;
+#if CONFIG_TEXT_RENDER_CACHE || CONFIG_TEXT_RENDER_LUT
+	// 1 bit image of one line of text, for the longer side so the display can be rotated
+	int text_width = (width > height) ? width : height;
+	dev->_text_run = heap_caps_malloc((text_width+7)/8*TEXT_RUN_HEIGHT, MALLOC_CAP_DEFAULT);
+	if (dev->_text_run == NULL) {
+		ESP_LOGW(TAG, "heap_caps_malloc fail. Text is drawn character by character.");
+	} else {
+		dev->_text_run_size = (text_width+7)/8*TEXT_RUN_HEIGHT;
+	}
+#endif
 #if CONFIG_FRAME_BUFFER
-	ESP_LOGI(TAG, "MALLOC_CAP_DEFAULT: %d bytes", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-	ESP_LOGI(TAG, "MALLOC_CAP_INTERNAL: %d bytes", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
-	ESP_LOGI(TAG, "MALLOC_CAP_SPIRAM: %d bytes", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	ESP_LOGI(TAG, "MALLOC_CAP_DEFAULT: %zu bytes", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+	ESP_LOGI(TAG, "MALLOC_CAP_INTERNAL: %zu bytes", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+	ESP_LOGI(TAG, "MALLOC_CAP_SPIRAM: %zu bytes", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
 	ESP_LOGI(TAG, "Free heap size: %"PRIu32, esp_get_free_heap_size());
-	dev->_frame_buffer = heap_caps_malloc(sizeof(uint16_t)*width*height, MALLOC_CAP_DEFAULT);
+	// The frame buffer is sent by DMA without a copy
+	dev->_frame_buffer = heap_caps_malloc(sizeof(uint16_t)*width*height, MALLOC_CAP_DMA);
 	if (dev->_frame_buffer == NULL) {
 		ESP_LOGE(TAG, "heap_caps_malloc fail. Frame buffer is not available.");
 	} else {
 		ESP_LOGI(TAG, "heap_caps_malloc success. Frame buffer is available.");
 		dev->_use_frame_buffer = true;
+		// The panel content is unknown, send everything on the first flush
+		lcdAddDamage(dev, 0, 0, width-1, height-1);
+	}
+#endif
+	dev->_frame_buffers[0] = dev->_frame_buffer;
+	dev->_frame_buffers[1] = NULL;
+	dev->_flush_task = NULL;
+#if CONFIG_DOUBLE_BUFFER
+	if (dev->_use_frame_buffer) {
+		dev->_frame_buffers[1] = heap_caps_malloc(sizeof(uint16_t)*width*height, MALLOC_CAP_DMA);
+		if (dev->_frame_buffers[1] == NULL) {
+			ESP_LOGE(TAG, "heap_caps_malloc fail. Double buffer is not available.");
+			return;
+		}
+		dev->_flush_start = xSemaphoreCreateBinary();
+		dev->_flush_done = xSemaphoreCreateBinary();
+		assert(dev->_flush_start != NULL && dev->_flush_done != NULL);
+		xSemaphoreGive(dev->_flush_done);
+#ifdef CONFIG_FLUSH_TASK_CORE
+		BaseType_t core = CONFIG_FLUSH_TASK_CORE;
+#else
+		BaseType_t core = tskNO_AFFINITY;
+#endif
+		BaseType_t ret = xTaskCreatePinnedToCore(lcdFlushTask, "lcd_flush", FLUSH_TASK_STACK, dev, FLUSH_TASK_PRIORITY, &dev->_flush_task, core);
+		assert(ret==pdPASS);
+		ESP_LOGI(TAG, "Double buffer is available.");
 	}
 #endif
 }
 
+// Rotate the display
+// rotation:DIRECTION0, DIRECTION90, DIRECTION180 or DIRECTION270 (clockwise)
+// The panel scans the memory in the rotated order (MADCTL), so drawing
+// keeps using the same row-major paths in every rotation.
+// Width, height and offsets change to match; the screen must be redrawn.
+void lcdSetRotation(TFT_t * dev, DIRECTION rotation) {
+	// MY MX MV bits of MADCTL
+	static const uint8_t madctl[] = {0x00, 0x60, 0xC0, 0xA0};
+	if (rotation > DIRECTION270) return;
+
+	// Hardware scrolling follows the unrotated rows
+	if (dev->_scroll_height != 0) lcdSetScrollArea(dev, 0, 0);
+	lcdWaitFinish(dev);
+	spi_master_fence(dev);
+
+	uint16_t width = dev->_panel_width;
+	uint16_t height = dev->_panel_height;
+	uint16_t offsetx = dev->_panel_offsetx;
+	uint16_t offsety = dev->_panel_offsety;
+	if (rotation == DIRECTION90) {
+		dev->_width = height;
+		dev->_height = width;
+		dev->_offsetx = offsety;
+		dev->_offsety = GRAM_WIDTH - width - offsetx;
+	} else if (rotation == DIRECTION180) {
+		dev->_width = width;
+		dev->_height = height;
+		dev->_offsetx = GRAM_WIDTH - width - offsetx;
+		dev->_offsety = GRAM_HEIGHT - height - offsety;
+	} else if (rotation == DIRECTION270) {
+		dev->_width = height;
+		dev->_height = width;
+		dev->_offsetx = GRAM_HEIGHT - height - offsety;
+		dev->_offsety = offsetx;
+	} else {
+		dev->_width = width;
+		dev->_height = height;
+		dev->_offsetx = offsetx;
+		dev->_offsety = offsety;
+	}
+	dev->_rotation = rotation;
+	ESP_LOGI(TAG, "rotation=%d width=%d height=%d offsetx=%d offsety=%d",
+		rotation, dev->_width, dev->_height, dev->_offsetx, dev->_offsety);
+
+	spi_master_write_command(dev, 0x36);	//Memory Data Access Control
+	spi_master_write_data_byte(dev, madctl[rotation]);
+
+	dev->_band_y = 0;
+	dev->_band_height = dev->_height;
+	if (dev->_use_frame_buffer) {
+		// The frame buffer layout changed, send everything on the next flush
+		dev->_damage_count = 0;
+		lcdAddDamage(dev, 0, 0, dev->_width-1, dev->_height-1);
+	}
+}
+
+// Set the address window and start a memory write
+// x1:Start X coordinate
+// y1:Start Y coordinate
+// x2:End X coordinate
+// y2:End Y coordinate
+// CASET/RASET are skipped when the panel already holds the same range.
+// The commands are queued back to back and DC is switched by the SPI driver.
+void lcdSetWindow(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
+	uint16_t _x1 = x1 + dev->_offsetx;
+	uint16_t _x2 = x2 + dev->_offsetx;
+	uint16_t _y1 = y1 + dev->_offsety;
+	uint16_t _y2 = y2 + dev->_offsety;
+	uint8_t Byte[4];
+
+	if (!dev->_window_valid || dev->_window_x1 != _x1 || dev->_window_x2 != _x2) {
+		Byte[0] = (_x1 >> 8) & 0xFF;
+		Byte[1] = _x1 & 0xFF;
+		Byte[2] = (_x2 >> 8) & 0xFF;
+		Byte[3] = _x2 & 0xFF;
+		spi_master_queue_command(dev, 0x2A, Byte, 4);	// set column(x) address
+	}
+	if (!dev->_window_valid || dev->_window_y1 != _y1 || dev->_window_y2 != _y2) {
+		Byte[0] = (_y1 >> 8) & 0xFF;
+		Byte[1] = _y1 & 0xFF;
+		Byte[2] = (_y2 >> 8) & 0xFF;
+		Byte[3] = _y2 & 0xFF;
+		spi_master_queue_command(dev, 0x2B, Byte, 4);	// set Page(y) address
+	}
+	spi_master_queue_command(dev, 0x2C, NULL, 0);	// Memory Write
+	if (!dev->_async) spi_master_fence(dev);
+
+	dev->_window_valid = true;
+	dev->_window_x1 = _x1;
+	dev->_window_x2 = _x2;
+	dev->_window_y1 = _y1;
+	dev->_window_y2 = _y2;
+}
 
 // Draw pixel
 // x:X coordinate
@@ -280,18 +810,12 @@ void lcdDrawPixel(TFT_t * dev, uint16_t x, uint16_t y, uint16_t color){
 	if (y >= dev->_height) return;
 
 	if (dev->_use_frame_buffer) {
-		dev->_frame_buffer[y*dev->_width+x] = color;
+		if (y < dev->_band_y || y >= dev->_band_y+dev->_band_height) return;
+		dev->_frame_buffer[(y-dev->_band_y)*dev->_width+x] = SWAP16(color);
+		lcdAddDamage(dev, x, y, x, y);
 	} else {
-		uint16_t _x = x + dev->_offsetx;
-		uint16_t _y = y + dev->_offsety;
-
-		spi_master_write_command(dev, 0x2A);	// set column(x) address
-		spi_master_write_addr(dev, _x, _x);
-		spi_master_write_command(dev, 0x2B);	// set Page(y) address
-		spi_master_write_addr(dev, _y, _y);
-		spi_master_write_command(dev, 0x2C);	// Memory Write
-		//spi_master_write_data_word(dev, color);
-		spi_master_write_colors(dev, &color, 1);
+		lcdSetWindow(dev, x, y, x, y);
+		spi_master_write_color(dev, color, 1);
 	}
 }
 
@@ -311,26 +835,347 @@ void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint
 		uint16_t _y1 = y;
 		uint16_t _y2 = _y1;
 		int16_t index = 0;
+		if (y < dev->_band_y || y >= dev->_band_y+dev->_band_height) return;
 		for (int16_t j = _y1; j <= _y2; j++){
 			for(int16_t i = _x1; i <= _x2; i++){
-				 dev->_frame_buffer[j*dev->_width+i] = colors[index++];
+				 dev->_frame_buffer[(j-dev->_band_y)*dev->_width+i] = SWAP16(colors[index]);
+				 index++;
 			}
 		}
+		lcdAddDamage(dev, _x1, _y1, _x2, _y2);
 	} else {
-		uint16_t _x1 = x + dev->_offsetx;
-		uint16_t _x2 = _x1 + (size-1);
-		uint16_t _y1 = y + dev->_offsety;
-		uint16_t _y2 = _y1;
-
-		spi_master_write_command(dev, 0x2A);	// set column(x) address
-		spi_master_write_addr(dev, _x1, _x2);
-		spi_master_write_command(dev, 0x2B);	// set Page(y) address
-		spi_master_write_addr(dev, _y1, _y2);
-		spi_master_write_command(dev, 0x2C);	// Memory Write
+		lcdSetWindow(dev, x, y, x+(size-1), y);
 		spi_master_write_colors(dev, colors, size);
 	}
 }
 
+// RGB565 pixel i of a source row, in CPU byte order
+static inline uint16_t sourcePixel(const uint8_t *row, PIXEL_FORMAT_t format, const uint16_t *palette, uint32_t i)
+{
+	switch (format) {
+	case PIXEL_RGB565:
+		return ((const uint16_t *)row)[i];
+	case PIXEL_RGB565_BE:
+		return (row[i*2] << 8) | row[i*2+1];
+	case PIXEL_RGB888:
+		return rgb565(row[i*3], row[i*3+1], row[i*3+2]);
+	case PIXEL_GRAY8:
+		return rgb565(row[i], row[i], row[i]);
+	case PIXEL_MONO1:
+		return palette[(row[i/8] >> (7 - i%8)) & 1];
+	case PIXEL_INDEX8:
+		return palette[row[i]];
+	}
+	return 0;
+}
+
+// Swap the bytes of both RGB565 pixels in a word
+#define SWAP16X2(w) ((((w) & 0x00FF00FFu) << 8) | (((w) >> 8) & 0x00FF00FFu))
+// RGB565 of two 8 bit channel values per word, one in each half
+#define RGB565X2(r, g, b) ((((r) & 0x00F800F8u) << 8) | (((g) & 0x00FC00FCu) << 3) | (((b) >> 3) & 0x001F001Fu))
+
+// RGB565 of every 4 pixel pattern of PIXEL_MONO1, in panel byte order
+// Pattern n has its first pixel in bit 3, words[n][0] holds the first two pixels.
+typedef struct {
+	uint32_t words[16][2];
+} MONO_TABLE_t;
+
+// Fill the table for palette[0] as background and palette[1] as foreground
+static void monoTable(MONO_TABLE_t *mono, const uint16_t *palette)
+{
+	uint32_t fg = SWAP16(palette[1]);
+	uint32_t bg = SWAP16(palette[0]);
+	for (int n=0;n<16;n++) {
+		uint32_t p0 = (n & 8) ? fg : bg;
+		uint32_t p1 = (n & 4) ? fg : bg;
+		uint32_t p2 = (n & 2) ? fg : bg;
+		uint32_t p3 = (n & 1) ? fg : bg;
+		mono->words[n][0] = p0 | (p1 << 16);
+		mono->words[n][1] = p2 | (p3 << 16);
+	}
+}
+
+// Four bits of a PIXEL_MONO1 row starting at pixel bit, as a table index
+// The next byte is only read when the nibble crosses into it.
+static inline uint32_t monoNibble(const uint8_t *row, uint32_t bit)
+{
+	uint32_t v = row[bit/8] << 8;
+	if (bit%8 > 4) v |= row[bit/8+1];
+	return (v >> (12 - bit%8)) & 0xF;
+}
+
+// Convert count source pixels from pixel sx of row to RGB565 in panel byte order
+// dst must be 2 byte aligned. Pixels are converted two per 32 bit word.
+// mono:Expansion table of the palette, only used for PIXEL_MONO1
+static void convertPixels(uint8_t *dst, const uint8_t *row, PIXEL_FORMAT_t format, const uint16_t *palette, const MONO_TABLE_t *mono, uint32_t sx, uint32_t count)
+{
+	uint16_t *out16 = (uint16_t *)dst;
+	if (((uintptr_t)out16 & 2) && count > 0) {
+		*out16++ = SWAP16(sourcePixel(row, format, palette, sx));
+		sx++;
+		count--;
+	}
+
+	uint32_t *out = (uint32_t *)out16;
+	uint32_t pairs = count / 2;
+	switch (format) {
+	case PIXEL_RGB565: {
+		const uint16_t *src = (const uint16_t *)row + sx;
+		for (uint32_t i=0;i<pairs;i++,src+=2) {
+			uint32_t w = src[0] | ((uint32_t)src[1] << 16);
+			out[i] = SWAP16X2(w);
+		}
+		break;
+	}
+	case PIXEL_RGB565_BE:
+		memcpy(out, row + sx*2, pairs*4);
+		break;
+	case PIXEL_RGB888: {
+		const uint8_t *src = row + sx*3;
+		for (uint32_t i=0;i<pairs;i++,src+=6) {
+			uint32_t r = src[0] | ((uint32_t)src[3] << 16);
+			uint32_t g = src[1] | ((uint32_t)src[4] << 16);
+			uint32_t b = src[2] | ((uint32_t)src[5] << 16);
+			out[i] = SWAP16X2(RGB565X2(r, g, b));
+		}
+		break;
+	}
+	case PIXEL_GRAY8: {
+		const uint8_t *src = row + sx;
+		for (uint32_t i=0;i<pairs;i++,src+=2) {
+			uint32_t l = src[0] | ((uint32_t)src[1] << 16);
+			out[i] = SWAP16X2(RGB565X2(l, l, l));
+		}
+		break;
+	}
+	case PIXEL_MONO1: {
+		// Four pixels per nibble, written as two table words
+		uint32_t bit = sx;
+		uint32_t i = 0;
+		for (;i+2<=pairs;i+=2,bit+=4) {
+			const uint32_t *words = mono->words[monoNibble(row, bit)];
+			out[i] = words[0];
+			out[i+1] = words[1];
+		}
+		if (i < pairs) {
+			uint32_t b0 = (row[bit/8] >> (7 - bit%8)) & 1;
+			uint32_t b1 = (row[(bit+1)/8] >> (7 - (bit+1)%8)) & 1;
+			out[i] = mono->words[(b0 << 3) | (b1 << 2)][0];
+		}
+		break;
+	}
+	case PIXEL_INDEX8: {
+		const uint8_t *src = row + sx;
+		for (uint32_t i=0;i<pairs;i++,src+=2) {
+			uint32_t w = palette[src[0]] | ((uint32_t)palette[src[1]] << 16);
+			out[i] = SWAP16X2(w);
+		}
+		break;
+	}
+	}
+
+	if (count & 1) {
+		out16 = (uint16_t *)&out[pairs];
+		*out16 = SWAP16(sourcePixel(row, format, palette, sx + count - 1));
+	}
+}
+
+// Append count source pixels to a pixel stream, converted on the way
+// RGB565 is converted straight into the transaction buffers,
+// RGB444 goes through a small RGB565 chunk that is then packed.
+static void spi_master_stream_convert(TFT_t * dev, PIXEL_STREAM_t *s, const uint8_t *row, PIXEL_FORMAT_t format, const uint16_t *palette, const MONO_TABLE_t *mono, uint32_t sx, uint32_t count)
+{
+#if CONFIG_COLOR_RGB444
+	uint16_t chunk[64];
+	while (count > 0) {
+		uint32_t n = (count > 64) ? 64 : count;
+		convertPixels((uint8_t *)chunk, row, format, palette, mono, sx, n);
+		spi_master_stream_pixels(dev, s, chunk, n, true);
+		sx += n;
+		count -= n;
+	}
+#else
+	while (count > 0) {
+		if (s->data == NULL) {
+			s->data = spi_master_get_data(dev, PIXEL_BUFFER_SIZE);
+			s->index = 0;
+		}
+		uint32_t n = (PIXEL_BUFFER_SIZE - s->index) / 2;
+		if (n > count) n = count;
+		convertPixels(s->data + s->index, row, format, palette, mono, sx, n);
+		s->index += n*2;
+		sx += n;
+		count -= n;
+		if (s->index == PIXEL_BUFFER_SIZE) {
+			spi_master_queue_data(dev, SPI_Data_Mode, s->index);
+			s->data = NULL;
+		}
+	}
+#endif
+}
+
+// Copy a source rectangle to the screen
+// Negative destination coordinates and parts beyond the screen are clipped.
+// Pixels equal to key are skipped when use_key is set, which needs PIXEL_RGB565
+// or PIXEL_MONO1. A PIXEL_MONO1 image with the key as palette[0] draws only its set bits.
+static void lcdBlitRect(TFT_t * dev, int x, int y, const IMAGE_t *image, int sx, int sy, int w, int h, bool use_key, uint16_t key) {
+	if (x < 0) {
+		sx -= x;
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		sy -= y;
+		h += y;
+		y = 0;
+	}
+	if (x+w > dev->_width) w = dev->_width - x;
+	if (y+h > dev->_height) h = dev->_height - y;
+	if (w <= 0 || h <= 0) return;
+	const uint8_t *data = image->data;
+	MONO_TABLE_t mono;
+	if (image->format == PIXEL_MONO1) monoTable(&mono, image->palette);
+
+	if (dev->_use_frame_buffer) {
+		// Clip to the rows held by the frame buffer
+		int y1 = (y < dev->_band_y) ? dev->_band_y : y;
+		int y2 = (y+h > dev->_band_y+dev->_band_height) ? dev->_band_y+dev->_band_height-1 : y+h-1;
+		for (int j=y1;j<=y2;j++) {
+			const uint8_t *row = &data[(sy+j-y)*image->stride];
+			uint16_t *dst = &dev->_frame_buffer[(j-dev->_band_y)*dev->_width+x];
+			if (use_key) {
+				for (int i=0;i<w;i++) {
+					uint16_t pixel = sourcePixel(row, image->format, image->palette, sx+i);
+					if (pixel != key) dst[i] = SWAP16(pixel);
+				}
+			} else {
+				convertPixels((uint8_t *)dst, row, image->format, image->palette, &mono, sx, w);
+			}
+		}
+		if (y1 <= y2) lcdAddDamage(dev, x, y1, x+w-1, y2);
+		return;
+	}
+
+	if (use_key && image->format == PIXEL_MONO1) {
+		// One window per run of one color, sent as a fill
+		lcdBeginBatch(dev);
+		for (int j=0;j<h;j++) {
+			const uint8_t *row = &data[(sy+j)*image->stride];
+			int i = 0;
+			while (i < w) {
+				uint16_t pixel = sourcePixel(row, PIXEL_MONO1, image->palette, sx+i);
+				if (pixel == key) {
+					i++;
+					continue;
+				}
+				int run = i;
+				while (i < w && sourcePixel(row, PIXEL_MONO1, image->palette, sx+i) == pixel) i++;
+				lcdSetWindow(dev, x+run, y+j, x+i-1, y+j);
+				spi_master_queue_fill(dev, pixel, i-run);
+			}
+		}
+		if (!dev->_async) spi_master_fence(dev);
+		lcdEndBatch(dev);
+		return;
+	}
+
+	if (use_key) {
+		// One window per run of visible pixels
+		lcdBeginBatch(dev);
+		for (int j=0;j<h;j++) {
+			const uint16_t *src = (const uint16_t *)&data[(sy+j)*image->stride] + sx;
+			int i = 0;
+			while (i < w) {
+				if (src[i] == key) {
+					i++;
+					continue;
+				}
+				int run = i;
+				while (i < w && src[i] != key) i++;
+				lcdSetWindow(dev, x+run, y+j, x+i-1, y+j);
+				spi_master_write_colors(dev, (uint16_t *)&src[run], i-run);
+			}
+		}
+		lcdEndBatch(dev);
+		return;
+	}
+
+	// One window, rows converted back to back into the transfer buffers
+	lcdSetWindow(dev, x, y, x+w-1, y+h-1);
+	PIXEL_STREAM_t stream = {0};
+	for (int j=0;j<h;j++) {
+		spi_master_stream_convert(dev, &stream, &data[(sy+j)*image->stride], image->format, image->palette, &mono, sx, w);
+	}
+	spi_master_stream_end(dev, &stream);
+	if (!dev->_async) spi_master_fence(dev);
+}
+
+// Draw image in any source pixel format
+// x:Destination X coordinate
+// y:Destination Y coordinate
+// image:Source image
+// sx:Source X coordinate
+// sy:Source Y coordinate
+// w:Width to copy
+// h:Height to copy
+// Pixels are converted while they are copied, no RGB565 copy of the image is needed.
+void lcdBlitImage(TFT_t * dev, int16_t x, int16_t y, const IMAGE_t *image, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h) {
+	lcdBlitRect(dev, x, y, image, sx, sy, w, h, false, 0);
+}
+
+// Draw multi pixel in any source pixel format
+// x:X coordinate
+// y:Y coordinate
+// size:Number of pixels
+// pixels:Source pixels
+// format:Source pixel format
+// palette:RGB565 colors for PIXEL_MONO1 and PIXEL_INDEX8
+void lcdDrawMultiPixelsFormat(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, const void *pixels, PIXEL_FORMAT_t format, const uint16_t *palette) {
+	IMAGE_t image = {
+		.format = format,
+		.data = pixels,
+		.stride = 0,
+		.palette = palette,
+	};
+	lcdBlitRect(dev, x, y, &image, 0, 0, size, 1, false, 0);
+}
+
+// Draw RGB565 image
+// x:Destination X coordinate
+// y:Destination Y coordinate
+// image:Source image
+// stride:Pixels per row of the source image
+// sx:Source X coordinate
+// sy:Source Y coordinate
+// w:Width to copy
+// h:Height to copy
+void lcdBlit(TFT_t * dev, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h) {
+	IMAGE_t source = {
+		.format = PIXEL_RGB565,
+		.data = image,
+		.stride = stride*2,
+	};
+	lcdBlitRect(dev, x, y, &source, sx, sy, w, h, false, 0);
+}
+
+// Draw RGB565 image with transparent color
+// key:Pixels of this color are not drawn
+// Other arguments are the same as lcdBlit.
+void lcdBlitKey(TFT_t * dev, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h, uint16_t key) {
+	IMAGE_t source = {
+		.format = PIXEL_RGB565,
+		.data = image,
+		.stride = stride*2,
+	};
+	lcdBlitRect(dev, x, y, &source, sx, sy, w, h, true, key);
+}
+
+// Area of a rectangle in pixels
+static uint32_t rectArea(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	return (uint32_t)(x2-x1+1) * (y2-y1+1);
+}
+
 // Draw rectangle of filling
 // x1:Start X coordinate
 // y1:Start Y coordinate
@@ -342,30 +1187,27 @@ void lcdDrawFillRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_
 	if (x2 >= dev->_width) x2=dev->_width-1;
 	if (y1 >= dev->_height) return;
 	if (y2 >= dev->_height) y2=dev->_height-1;
+	if (x1 > x2 || y1 > y2) return;
 
 	ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
 
 	if (dev->_use_frame_buffer) {
+		// Clip to the rows held by the frame buffer
+		if (y1 < dev->_band_y) y1 = dev->_band_y;
+		if (y2 >= dev->_band_y+dev->_band_height) y2 = dev->_band_y+dev->_band_height-1;
+		if (y1 > y2) return;
+		uint16_t _color = SWAP16(color);
 		for (int16_t j = y1; j <= y2; j++){
 			for(int16_t i = x1; i <= x2; i++){
-				dev->_frame_buffer[j*dev->_width+i] = color;
+				dev->_frame_buffer[(j-dev->_band_y)*dev->_width+i] = _color;
 			}
 		}
+		lcdAddDamage(dev, x1, y1, x2, y2);
 	} else {
-		uint16_t _x1 = x1 + dev->_offsetx;
-		uint16_t _x2 = x2 + dev->_offsetx;
-		uint16_t _y1 = y1 + dev->_offsety;
-		uint16_t _y2 = y2 + dev->_offsety;
-
-		spi_master_write_command(dev, 0x2A);	// set column(x) address
-		spi_master_write_addr(dev, _x1, _x2);
-		spi_master_write_command(dev, 0x2B);	// set Page(y) address
-		spi_master_write_addr(dev, _y1, _y2);
-		spi_master_write_command(dev, 0x2C);	// Memory Write
-		for(int i=_x1;i<=_x2;i++){
-			uint16_t size = _y2-_y1+1;
-			spi_master_write_color(dev, color, size);
-		}
+		// One window, sent in a few large transfers
+		lcdSetWindow(dev, x1, y1, x2, y2);
+		spi_master_queue_fill(dev, color, rectArea(x1, y1, x2, y2));
+		if (!dev->_async) spi_master_fence(dev);
 	}
 }
 
@@ -384,11 +1226,13 @@ void lcdDrawFillSquare(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t size, uin
 
 // Display OFF
 void lcdDisplayOff(TFT_t * dev) {
+	lcdWaitFinish(dev);
 	spi_master_write_command(dev, 0x28);	// Display off
 }
  
 // Display ON
 void lcdDisplayOn(TFT_t * dev) {
+	lcdWaitFinish(dev);
 	spi_master_write_command(dev, 0x29);	// Display on
 }
 
@@ -418,32 +1262,57 @@ void lcdDrawLine(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2
 	sx = ( x2 > x1 ) ? 1 : -1;
 	sy = ( y2 > y1 ) ? 1 : -1;
 
+	/* horizontal and vertical lines are one window */
+	if ( dy == 0 ) {
+		lcdDrawFillRect(dev, (sx > 0) ? x1 : x2, y1, (sx > 0) ? x2 : x1, y1, color);
+		return;
+	}
+	if ( dx == 0 ) {
+		lcdDrawFillRect(dev, x1, (sy > 0) ? y1 : y2, x1, (sy > 0) ? y2 : y1, color);
+		return;
+	}
+
+	/* other lines are drawn as runs of pixels on the same row or column */
+	int run;
+	int last;
+	lcdBeginBatch(dev);
 	/* inclination < 1 */
 	if ( dx > dy ) {
 		E = -dx;
+		run = x1;
 		for ( i = 0 ; i <= dx ; i++ ) {
-			lcdDrawPixel(dev, x1, y1, color);
+			last = x1;
 			x1 += sx;
 			E += 2 * dy;
+			if ( E >= 0 || i == dx ) {
+				lcdDrawFillRect(dev, (sx > 0) ? run : last, y1, (sx > 0) ? last : run, y1, color);
+				run = x1;
+			}
 			if ( E >= 0 ) {
-			y1 += sy;
-			E -= 2 * dx;
+				y1 += sy;
+				E -= 2 * dx;
+			}
 		}
-	}
 
 	/* inclination >= 1 */
 	} else {
 		E = -dy;
+		run = y1;
 		for ( i = 0 ; i <= dy ; i++ ) {
-			lcdDrawPixel(dev, x1, y1, color);
+			last = y1;
 			y1 += sy;
 			E += 2 * dx;
+			if ( E >= 0 || i == dy ) {
+				lcdDrawFillRect(dev, x1, (sy > 0) ? run : last, x1, (sy > 0) ? last : run, color);
+				run = y1;
+			}
 			if ( E >= 0 ) {
 				x1 += sx;
 				E -= 2 * dy;
 			}
 		}
 	}
+	lcdEndBatch(dev);
 }
 
 // Draw rectangle
@@ -459,6 +1328,73 @@ void lcdDrawRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2
 	lcdDrawLine(dev, x1, y2, x1, y1, color);
 }
 
+// Quarter wave of sin in Q15, sin(i * 90 / 256 degrees) * 32768
+static const int16_t sinTable[ANGLE_STEPS/4+1] = {
+	    0,   201,   402,   603,   804,  1005,  1206,  1407,
+	 1608,  1809,  2009,  2210,  2411,  2611,  2811,  3012,
+	 3212,  3412,  3612,  3812,  4011,  4211,  4410,  4609,
+	 4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,
+	 6393,  6590,  6787,  6983,  7180,  7376,  7571,  7767,
+	 7962,  8157,  8351,  8546,  8740,  8933,  9127,  9319,
+	 9512,  9704,  9896, 10088, 10279, 10469, 10660, 10850,
+	11039, 11228, 11417, 11605, 11793, 11980, 12167, 12354,
+	12540, 12725, 12910, 13095, 13279, 13463, 13646, 13828,
+	14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269,
+	15447, 15624, 15800, 15976, 16151, 16326, 16500, 16673,
+	16846, 17018, 17190, 17361, 17531, 17700, 17869, 18037,
+	18205, 18372, 18538, 18703, 18868, 19032, 19195, 19358,
+	19520, 19681, 19841, 20001, 20160, 20318, 20475, 20632,
+	20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+	22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028,
+	23170, 23312, 23453, 23593, 23732, 23870, 24008, 24144,
+	24279, 24414, 24548, 24680, 24812, 24943, 25073, 25202,
+	25330, 25457, 25583, 25708, 25833, 25956, 26078, 26199,
+	26320, 26439, 26557, 26674, 26791, 26906, 27020, 27133,
+	27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002,
+	28106, 28209, 28311, 28411, 28511, 28610, 28707, 28803,
+	28899, 28993, 29086, 29178, 29269, 29359, 29448, 29535,
+	29622, 29707, 29792, 29875, 29957, 30038, 30118, 30196,
+	30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784,
+	30853, 30920, 30986, 31050, 31114, 31177, 31238, 31298,
+	31357, 31415, 31471, 31527, 31581, 31634, 31686, 31737,
+	31786, 31834, 31881, 31927, 31972, 32015, 32058, 32099,
+	32138, 32177, 32214, 32251, 32286, 32319, 32352, 32383,
+	32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+	32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718,
+	32729, 32738, 32746, 32753, 32758, 32762, 32766, 32767,
+	32767,
+};
+
+// Sine of a binary angle in Q15
+// angle:ANGLE_STEPS per full circle
+int16_t lcdSinQ15(uint16_t angle) {
+	angle &= ANGLE_STEPS-1;
+	uint16_t index = angle & (ANGLE_STEPS/4-1);
+	switch (angle / (ANGLE_STEPS/4)) {
+	case 0: return sinTable[index];
+	case 1: return sinTable[ANGLE_STEPS/4-index];
+	case 2: return -sinTable[index];
+	default: return -sinTable[ANGLE_STEPS/4-index];
+	}
+}
+
+// Cosine of a binary angle in Q15
+int16_t lcdCosQ15(uint16_t angle) {
+	return lcdSinQ15(angle + ANGLE_STEPS/4);
+}
+
+// Degrees to binary angle
+static uint16_t degreeToAngle(int degree) {
+	return (degree * ANGLE_STEPS + 180) / 360;
+}
+
+// Rotate (xd, yd) by -angle around (xc, yc)
+// s/c are the Q15 sin/cos of the angle, the result is rounded.
+static void rotatePoint(int xd, int yd, int32_t s, int32_t c, int xc, int yc, POINT_t *p) {
+	p->x = ((xd * c + yd * s + (1 << 14)) >> 15) + xc;
+	p->y = ((yd * c - xd * s + (1 << 14)) >> 15) + yc;
+}
+
 // Draw rectangle with angle
 // xc:Center X coordinate
 // yc:Center Y coordinate
@@ -471,34 +1407,19 @@ void lcdDrawRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2
 // x1 = x * cos(angle) - y * sin(angle)
 // y1 = x * sin(angle) + y * cos(angle)
 void lcdDrawRectAngle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
-	double xd,yd,rd;
-	int x1,y1;
-	int x2,y2;
-	int x3,y3;
-	int x4,y4;
-	rd = -angle * M_PI / 180.0;
-	xd = 0.0 - w/2;
-	yd = h/2;
-	x1 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y1 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	yd = 0.0 - yd;
-	x2 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y2 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	xd = w/2;
-	yd = h/2;
-	x3 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y3 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	yd = 0.0 - yd;
-	x4 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y4 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	lcdDrawLine(dev, x1, y1, x2, y2, color);
-	lcdDrawLine(dev, x1, y1, x3, y3, color);
-	lcdDrawLine(dev, x2, y2, x4, y4, color);
-	lcdDrawLine(dev, x3, y3, x4, y4, color);
+	POINT_t p[4];
+	uint16_t a = degreeToAngle(angle);
+	int32_t s = lcdSinQ15(a);
+	int32_t c = lcdCosQ15(a);
+	rotatePoint(-(w/2),  (h/2), s, c, xc, yc, &p[0]);
+	rotatePoint(-(w/2), -(h/2), s, c, xc, yc, &p[1]);
+	rotatePoint( (w/2),  (h/2), s, c, xc, yc, &p[2]);
+	rotatePoint( (w/2), -(h/2), s, c, xc, yc, &p[3]);
+
+	lcdDrawLine(dev, p[0].x, p[0].y, p[1].x, p[1].y, color);
+	lcdDrawLine(dev, p[0].x, p[0].y, p[2].x, p[2].y, color);
+	lcdDrawLine(dev, p[1].x, p[1].y, p[3].x, p[3].y, color);
+	lcdDrawLine(dev, p[2].x, p[2].y, p[3].x, p[3].y, color);
 }
 
 // Draw triangle
@@ -512,29 +1433,116 @@ void lcdDrawRectAngle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_
 //When the origin is (0, 0), the point (x1, y1) after rotating the point (x, y) by the angle is obtained by the following calculation.
 // x1 = x * cos(angle) - y * sin(angle)
 // y1 = x * sin(angle) + y * cos(angle)
+static void triangleVertices(uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, POINT_t *p) {
+	uint16_t a = degreeToAngle(angle);
+	int32_t s = lcdSinQ15(a);
+	int32_t c = lcdCosQ15(a);
+	rotatePoint(0, (h/2), s, c, xc, yc, &p[0]);
+	rotatePoint( (w/2), -(h/2), s, c, xc, yc, &p[1]);
+	rotatePoint(-(w/2), -(h/2), s, c, xc, yc, &p[2]);
+}
+
 void lcdDrawTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
-	double xd,yd,rd;
-	int x1,y1;
-	int x2,y2;
-	int x3,y3;
-	rd = -angle * M_PI / 180.0;
-	xd = 0.0;
-	yd = h/2;
-	x1 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y1 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	xd = w/2;
-	yd = 0.0 - yd;
-	x2 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y2 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	xd = 0.0 - w/2;
-	x3 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-	y3 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-	lcdDrawLine(dev, x1, y1, x2, y2, color);
-	lcdDrawLine(dev, x1, y1, x3, y3, color);
-	lcdDrawLine(dev, x2, y2, x3, y3, color);
+	POINT_t p[3];
+	triangleVertices(xc, yc, w, h, angle, p);
+
+	lcdDrawLine(dev, p[0].x, p[0].y, p[1].x, p[1].y, color);
+	lcdDrawLine(dev, p[0].x, p[0].y, p[2].x, p[2].y, color);
+	lcdDrawLine(dev, p[1].x, p[1].y, p[2].x, p[2].y, color);
+}
+
+// Draw triangle of filling
+// xc:Center X coordinate
+// yc:Center Y coordinate
+// w:Width of triangle
+// h:Height of triangle
+// angle:Angle of triangle
+// color:color
+void lcdDrawFillTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
+	POINT_t p[3];
+	triangleVertices(xc, yc, w, h, angle, p);
+	lcdDrawFillPolygon(dev, p, 3, color);
+}
+
+// Draw one row of a filled shape, clipped to the screen
+static void lcdDrawSpan(TFT_t * dev, int x1, int x2, int y, uint16_t color) {
+	if (y < 0 || y >= dev->_height) return;
+	if (x1 < 0) x1 = 0;
+	if (x2 >= dev->_width) x2 = dev->_width-1;
+	if (x1 > x2) return;
+	lcdDrawFillRect(dev, x1, y, x2, y, color);
+}
+
+// Widen the row extents with the pixels of one edge
+// The edge is stepped the same way as lcdDrawLine.
+static void spanEdge(int x1, int y1, int x2, int y2, int ymin, int rows, int16_t *left, int16_t *right) {
+	int dx = ( x2 > x1 ) ? x2 - x1 : x1 - x2;
+	int dy = ( y2 > y1 ) ? y2 - y1 : y1 - y2;
+	int sx = ( x2 > x1 ) ? 1 : -1;
+	int sy = ( y2 > y1 ) ? 1 : -1;
+	int n = ( dx > dy ) ? dx : dy;
+	int E = -n;
+	for (int i = 0; i <= n; i++) {
+		int j = y1 - ymin;
+		if (j >= 0 && j < rows) {
+			if (x1 < left[j]) left[j] = x1;
+			if (x1 > right[j]) right[j] = x1;
+		}
+		if ( dx > dy ) {
+			x1 += sx;
+			E += 2 * dy;
+			if ( E >= 0 ) {
+				y1 += sy;
+				E -= 2 * dx;
+			}
+		} else {
+			y1 += sy;
+			E += 2 * dx;
+			if ( E >= 0 ) {
+				x1 += sx;
+				E -= 2 * dy;
+			}
+		}
+	}
+}
+
+// Draw convex polygon of filling
+// points:Vertices in drawing order
+// n:Number of vertices
+// color:color
+// Each row is drawn as one span. The outline drawn by lcdDrawLine is covered.
+void lcdDrawFillPolygon(TFT_t * dev, const POINT_t *points, uint16_t n, uint16_t color) {
+	if (n == 0) return;
+	int ymin = points[0].y;
+	int ymax = points[0].y;
+	for (int i = 1; i < n; i++) {
+		if (points[i].y < ymin) ymin = points[i].y;
+		if (points[i].y > ymax) ymax = points[i].y;
+	}
+	if (ymin < 0) ymin = 0;
+	if (ymax >= dev->_height) ymax = dev->_height-1;
+	if (ymin > ymax) return;
+
+	int rows = ymax - ymin + 1;
+	int16_t left[rows];
+	int16_t right[rows];
+	for (int j = 0; j < rows; j++) {
+		left[j] = INT16_MAX;
+		right[j] = INT16_MIN;
+	}
+	for (int i = 0; i < n; i++) {
+		const POINT_t *a = &points[i];
+		const POINT_t *b = &points[(i+1) % n];
+		// Both directions, as Bresenham is not symmetric
+		spanEdge(a->x, a->y, b->x, b->y, ymin, rows, left, right);
+		spanEdge(b->x, b->y, a->x, a->y, ymin, rows, left, right);
+	}
+
+	lcdBeginBatch(dev);
+	for (int j = 0; j < rows; j++) {
+		if (left[j] <= right[j]) lcdDrawSpan(dev, left[j], right[j], ymin+j, color);
+	}
+	lcdEndBatch(dev);
 }
 
 // Draw regular polygon
@@ -546,25 +1554,22 @@ void lcdDrawTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t
 // color:color
 void lcdDrawRegularPolygon(TFT_t *dev, uint16_t xc, uint16_t yc, uint16_t n, uint16_t r, uint16_t angle, uint16_t color)
 {
-	double xd, yd, rd;
-	int x1, y1;
-	int x2, y2;
+	POINT_t p1, p2;
 	int i;
 
-	rd = -angle * M_PI / 180.0;
+	if (n == 0) return;
+	// Vertex i is at 360*i/n degrees, turned back by angle
+	uint16_t a = -degreeToAngle(angle);
+	p1.x = ((r * lcdCosQ15(a) + (1 << 14)) >> 15) + xc;
+	p1.y = ((r * lcdSinQ15(a) + (1 << 14)) >> 15) + yc;
 	for (i = 0; i < n; i++)
 	{
-		xd = r * cos(2 * M_PI * i / n);
-		yd = r * sin(2 * M_PI * i / n);
-		x1 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-		y1 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
+		uint16_t b = a + ((i + 1) * ANGLE_STEPS + n / 2) / n;
+		p2.x = ((r * lcdCosQ15(b) + (1 << 14)) >> 15) + xc;
+		p2.y = ((r * lcdSinQ15(b) + (1 << 14)) >> 15) + yc;
 
-		xd = r * cos(2 * M_PI * (i + 1) / n);
-		yd = r * sin(2 * M_PI * (i + 1) / n);
-		x2 = (int)(xd * cos(rd) - yd * sin(rd) + xc);
-		y2 = (int)(xd * sin(rd) + yd * cos(rd) + yc);
-
-		lcdDrawLine(dev, x1, y1, x2, y2, color);
+		lcdDrawLine(dev, p1.x, p1.y, p2.x, p2.y, color);
+		p1 = p2;
 	}
 }
 
@@ -582,6 +1587,7 @@ void lcdDrawCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t c
 	x=0;
 	y=-r;
 	err=2-2*r;
+	lcdBeginBatch(dev);
 	do{
 		lcdDrawPixel(dev, x0-x, y0+y, color); 
 		lcdDrawPixel(dev, x0-y, y0-x, color); 
@@ -590,6 +1596,7 @@ void lcdDrawCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t c
 		if ((old_err=err)<=x)	err+=++x*2+1;
 		if (old_err>y || err>x) err+=++y*2+1;	 
 	} while(y<0);
+	lcdEndBatch(dev);
 }
 
 // Draw circle of filling
@@ -603,20 +1610,33 @@ void lcdDrawFillCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16
 	int err;
 	int old_err;
 	int ChangeX;
+	int16_t height[r+2];
+	int w = 0;
 
+	// Height of each column above and below the center
 	x=0;
 	y=-r;
 	err=2-2*r;
 	ChangeX=1;
 	do{
 		if(ChangeX) {
-			lcdDrawLine(dev, x0-x, y0-y, x0-x, y0+y, color);
-			lcdDrawLine(dev, x0+x, y0-y, x0+x, y0+y, color);
+			height[x] = -y;
+			w = x;
 		} // endif
 		ChangeX=(old_err=err)<=x;
 		if (ChangeX)			err+=++x*2+1;
 		if (old_err>y || err>x) err+=++y*2+1;
 	} while(y<=0);
+
+	// Draw the same pixels as rows
+	lcdBeginBatch(dev);
+	for (int t=0;t<=r;t++) {
+		while (w >= 0 && height[w] < t) w--;
+		if (w < 0) break;
+		lcdDrawSpan(dev, x0-w, x0+w, y0-t, color);
+		if (t) lcdDrawSpan(dev, x0-w, x0+w, y0+t, color);
+	}
+	lcdEndBatch(dev);
 } 
 
 // Draw rectangle with round corner
@@ -650,6 +1670,7 @@ void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16
 	y=-r;
 	err=2-2*r;
 
+	lcdBeginBatch(dev);
 	do{
 		if(x) {
 			lcdDrawPixel(dev, x1+r-x, y1+r+y, color); 
@@ -667,8 +1688,94 @@ void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16
 	ESP_LOGD(TAG, "y1+r=%d y2-r=%d",y1+r, y2-r);
 	lcdDrawLine(dev, x1  ,y1+r,x1  ,y2-r,color);
 	lcdDrawLine(dev, x2  ,y1+r,x2  ,y2-r,color);  
+	lcdEndBatch(dev);
 } 
 
+// Draw rectangle of filling with round corner
+// x1:Start X coordinate
+// y1:Start Y coordinate
+// x2:End	X coordinate
+// y2:End	Y coordinate
+// r:radius
+// color:color
+void lcdDrawFillRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t r, uint16_t color) {
+	int x;
+	int y;
+	int err;
+	int old_err;
+	uint16_t temp;
+
+	if(x1>x2) {
+		temp=x1; x1=x2; x2=temp;
+	} // endif
+	  
+	if(y1>y2) {
+		temp=y1; y1=y2; y2=temp;
+	} // endif
+
+	if (x2-x1 < r) return;
+	if (y2-y1 < r) return;
+
+	// Widest corner offset on each row, same points as lcdDrawRoundRect
+	int16_t width[r+1];
+	memset(width, 0, sizeof(width));
+	x=0;
+	y=-r;
+	err=2-2*r;
+	do{
+		if (x > width[-y]) width[-y] = x;
+		if ((old_err=err)<=x)	err+=++x*2+1;
+		if (old_err>y || err>x) err+=++y*2+1;	 
+	} while(y<0);
+
+	lcdBeginBatch(dev);
+	for (int t=r;t>0;t--) {
+		lcdDrawSpan(dev, x1+r-width[t], x2-r+width[t], y1+r-t, color);
+		lcdDrawSpan(dev, x1+r-width[t], x2-r+width[t], y2-r+t, color);
+	}
+	// The straight part is one rectangle
+	lcdDrawFillRect(dev, x1, y1+r, x2, y2-r, color);
+	lcdEndBatch(dev);
+}
+
+// Integer square root
+static uint32_t isqrt(uint32_t n) {
+	uint32_t root = 0;
+	uint32_t bit = 1u << 30;
+	while (bit > n) bit >>= 2;
+	while (bit) {
+		if (n >= root + bit) {
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+// a / b rounded to nearest, b > 0
+static int divRound(int32_t a, int32_t b) {
+	return (a >= 0) ? (a + b/2) / b : -((-a + b/2) / b);
+}
+
+// Tip and the two base corners of an arrow head
+// The base is w from the start point on each side, at right angles to the arrow.
+static bool arrowVertices(int x0, int y0, int x1, int y1, int w, POINT_t *p) {
+	int32_t Vx = x1 - x0;
+	int32_t Vy = y1 - y0;
+	int32_t v = isqrt(Vx*Vx + Vy*Vy);
+	if (v == 0) return false;
+	p[0].x = x1;
+	p[0].y = y1;
+	p[1].x = x0 - divRound(Vy*w, v);
+	p[1].y = y0 + divRound(Vx*w, v);
+	p[2].x = x0 + divRound(Vy*w, v);
+	p[2].y = y0 - divRound(Vx*w, v);
+	return true;
+}
+
 // Draw arrow
 // x1:Start X coordinate
 // y1:Start Y coordinate
@@ -678,24 +1785,14 @@ void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16
 // color:color
 // Thanks http://k-hiura.cocolog-nifty.com/blog/2010/11/post-2a62.html
 void lcdDrawArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,uint16_t w,uint16_t color) {
-	double Vx= x1 - x0;
-	double Vy= y1 - y0;
-	double v = sqrt(Vx*Vx+Vy*Vy);
-	//	 printf("v=%f\n",v);
-	double Ux= Vx/v;
-	double Uy= Vy/v;
-
-	uint16_t L[2],R[2];
-	L[0]= x1 - Uy*w - Ux*v;
-	L[1]= y1 + Ux*w - Uy*v;
-	R[0]= x1 + Uy*w - Ux*v;
-	R[1]= y1 - Ux*w - Uy*v;
-	//printf("L=%d-%d R=%d-%d\n",L[0],L[1],R[0],R[1]);
+	POINT_t p[3];
+	if (!arrowVertices(x0, y0, x1, y1, w, p)) return;
+	//printf("L=%d-%d R=%d-%d\n",p[1].x,p[1].y,p[2].x,p[2].y);
 
 	//lcdDrawLine(x0,y0,x1,y1,color);
-	lcdDrawLine(dev, x1, y1, L[0], L[1], color);
-	lcdDrawLine(dev, x1, y1, R[0], R[1], color);
-	lcdDrawLine(dev, L[0], L[1], R[0], R[1], color);
+	lcdDrawLine(dev, x1, y1, p[1].x, p[1].y, color);
+	lcdDrawLine(dev, x1, y1, p[2].x, p[2].y, color);
+	lcdDrawLine(dev, p[1].x, p[1].y, p[2].x, p[2].y, color);
 }
 
 
@@ -707,35 +1804,12 @@ void lcdDrawArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,u
 // w:Width of the botom
 // color:color
 void lcdDrawFillArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,uint16_t w,uint16_t color) {
-	double Vx= x1 - x0;
-	double Vy= y1 - y0;
-	double v = sqrt(Vx*Vx+Vy*Vy);
-	//printf("v=%f\n",v);
-	double Ux= Vx/v;
-	double Uy= Vy/v;
-
-	uint16_t L[2],R[2];
-	L[0]= x1 - Uy*w - Ux*v;
-	L[1]= y1 + Ux*w - Uy*v;
-	R[0]= x1 + Uy*w - Ux*v;
-	R[1]= y1 - Ux*w - Uy*v;
-	//printf("L=%d-%d R=%d-%d\n",L[0],L[1],R[0],R[1]);
+	POINT_t p[3];
+	if (!arrowVertices(x0, y0, x1, y1, w, p)) return;
+	//printf("L=%d-%d R=%d-%d\n",p[1].x,p[1].y,p[2].x,p[2].y);
 
 	lcdDrawLine(dev, x0, y0, x1, y1, color);
-	lcdDrawLine(dev, x1, y1, L[0], L[1], color);
-	lcdDrawLine(dev, x1, y1, R[0], R[1], color);
-	lcdDrawLine(dev, L[0], L[1], R[0], R[1], color);
-
-	int ww;
-	for(ww=w-1;ww>0;ww--) {
-		L[0]= x1 - Uy*ww - Ux*v;
-		L[1]= y1 + Ux*ww - Uy*v;
-		R[0]= x1 + Uy*ww - Ux*v;
-		R[1]= y1 - Ux*ww - Uy*v;
-		//printf("Fill>L=%d-%d R=%d-%d\n",L[0],L[1],R[0],R[1]);
-		lcdDrawLine(dev, x1, y1, L[0], L[1], color);
-		lcdDrawLine(dev, x1, y1, R[0], R[1], color);
-	}
+	lcdDrawFillPolygon(dev, p, 3, color);
 }
 
 
@@ -749,12 +1823,10 @@ int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t asc
 	unsigned char pw, ph;
 	int h,w;
 	uint16_t mask;
-	bool rc;
+	const uint8_t *glyph;
 
 	if(_DEBUG_)printf("_font_direction=%d\n",dev->_font_direction);
-	rc = GetFontx(fxs, ascii, &pw, &ph);
-	if(_DEBUG_)printf("GetFontx rc=%d pw=%d ph=%d\n",rc,pw,ph);
-	if (!rc) return 0;
+	if (!GetFontxSize(fxs, &pw, &ph)) return 0;
 
 	int16_t xd1 = 0;
 	int16_t yd1 = 0;
@@ -831,6 +1903,30 @@ int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t asc
 		y1	= y;
 	}
 
+#if CONFIG_TEXT_RENDER_CACHE
+	// Opaque glyphs are sent as one window of cached pixels.
+	// A cell hanging off the top or left edge keeps the pixel path, which drops its background.
+	if (dev->_font_fill && x0 < dev->_width && y0 < dev->_height) {
+		uint8_t cw, ch;
+		const uint16_t *cell = glyphCacheGet(fxs, ascii, dev->_font_direction, color, dev->_font_fill_color,
+			dev->_font_underline, dev->_font_underline_color, &cw, &ch);
+		if (cell != NULL) {
+			IMAGE_t image = {
+				.format = PIXEL_RGB565_BE,
+				.data = cell,
+				.stride = cw*2,
+			};
+			lcdBlitImage(dev, (int16_t)x0, (int16_t)y0, &image, 0, 0, cw, ch);
+			if (next < 0) next = 0;
+			return next;
+		}
+	}
+#endif
+
+	glyph = GetFontxGlyph(fxs, ascii, &pw, &ph);
+	if(_DEBUG_)printf("GetFontxGlyph glyph=%p pw=%d ph=%d\n",glyph,pw,ph);
+	if (glyph == NULL) return 0;
+
 	if (dev->_font_fill) lcdDrawFillRect(dev, x0, y0, x1, y1, dev->_font_fill_color);
 
 	int bits;
@@ -848,16 +1944,14 @@ int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t asc
 			for(bit=0;bit<8;bit++) {
 				bits--;
 				if (bits < 0) continue;
-				//if(_DEBUG_)printf("xx=%d yy=%d mask=%02x fonts[%d]=%02x\n",xx,yy,mask,ofs,fxs->fonts[ofs]);
-				if (fxs->fonts[ofs] & mask) {
+				//if(_DEBUG_)printf("xx=%d yy=%d mask=%02x glyph[%d]=%02x\n",xx,yy,mask,ofs,glyph[ofs]);
+				if (h >= (ph-2) && dev->_font_underline) {
+					// Covered by the underline
+				} else if (glyph[ofs] & mask) {
 					lcdDrawPixel(dev, xx, yy, color);
 				} else {
 					//if (dev->_font_fill) lcdDrawPixel(dev, xx, yy, dev->_font_fill_color);
 				}
-				if (h == (ph-2) && dev->_font_underline)
-					lcdDrawPixel(dev, xx, yy, dev->_font_underline_color);
-				if (h == (ph-1) && dev->_font_underline)
-					lcdDrawPixel(dev, xx, yy, dev->_font_underline_color);
 				xx = xx + xd1;
 				yy = yy + yd2;
 				mask = mask >> 1;
@@ -868,13 +1962,99 @@ int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t asc
 		xx = xx + xd2;
 	}
 
+	if (dev->_font_underline) {
+		// The last two rows of the glyph as one rectangle
+		int ux0 = xss + (ph-2)*xd2;
+		int uy0 = yss + (ph-2)*yd1;
+		int ux1 = xss + (ph-1)*xd2 + (pw-1)*xd1;
+		int uy1 = yss + (ph-1)*yd1 + (pw-1)*yd2;
+		if (ux0 > ux1) { int t = ux0; ux0 = ux1; ux1 = t; }
+		if (uy0 > uy1) { int t = uy0; uy0 = uy1; uy1 = t; }
+		if (ux0 < 0) ux0 = 0;
+		if (uy0 < 0) uy0 = 0;
+		if (ux1 >= 0 && uy1 >= 0) lcdDrawFillRect(dev, ux0, uy0, ux1, uy1, dev->_font_underline_color);
+	}
+
 	if (next < 0) next = 0;
 	return next;
 }
 
+#if CONFIG_TEXT_RENDER_CACHE || CONFIG_TEXT_RENDER_LUT
+// Draw a line of text in font direction 0 from a 1 bit image
+// The glyph rows of all visible characters are put side by side into a
+// 1 bit image. Opaque text is expanded to RGB565 while it is sent as one
+// window, transparent text is sent as one fill per run of set bits.
+// Returns the X coordinate after the text, or -1 when the line must be
+// drawn character by character.
+static int lcdDrawTextRun(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t * ascii, int length, uint16_t color) {
+	uint8_t pw, ph;
+	if (!GetFontxSize(fx, &pw, &ph)) return -1;
+	int next = (uint16_t)(x + length*pw);
+	// Cells above the screen keep the pixel path, which drops their background
+	if (y < ph-1 || y-(ph-1) >= dev->_height || x >= dev->_width) return -1;
+
+	int w = length*pw;
+	if (x+w > dev->_width) w = dev->_width - x;
+	if (w <= 0) return next;
+	int count = (w + pw - 1) / pw;
+	int stride = (w + 7) / 8;
+	if (stride*ph > dev->_text_run_size) return -1;
+	uint8_t *bitmap = dev->_text_run;
+	memset(bitmap, 0, stride*ph);
+
+	for (int i=0;i<count;i++) {
+		const uint8_t *glyph = GetFontxGlyph(fx, ascii[i], &pw, &ph);
+		if (glyph == NULL) return -1;
+		// Shift each glyph row into place, a byte at a time
+		int gstride = (pw + 7) / 8;
+		int shift = (i*pw) % 8;
+		for (int r=0;r<ph;r++) {
+			uint8_t *dst = &bitmap[r*stride + (i*pw)/8];
+			uint8_t *end = &bitmap[(r+1)*stride];
+			for (int k=0;k<gstride;k++) {
+				uint8_t bits = glyph[r*gstride + k];
+				if (k == gstride-1 && pw%8) bits &= 0xFF << (8 - pw%8);
+				if (dst+k < end) dst[k] |= bits >> shift;
+				if (shift && dst+k+1 < end) dst[k+1] |= bits << (8 - shift);
+			}
+		}
+	}
+
+	// Transparent text keys out the clear bits with a color that is not the text color
+	uint16_t background = dev->_font_fill ? dev->_font_fill_color : (uint16_t)~color;
+	uint16_t palette[2] = {background, color};
+	IMAGE_t image = {
+		.format = PIXEL_MONO1,
+		.data = bitmap,
+		.stride = stride,
+		.palette = palette,
+	};
+	int y0 = y - (ph-1);
+	int rows = dev->_font_underline ? ph-2 : ph;
+	lcdBeginBatch(dev);
+	lcdBlitRect(dev, x, y0, &image, 0, 0, w, rows, !dev->_font_fill, background);
+	if (dev->_font_underline) lcdDrawFillRect(dev, x, y-1, x+w-1, y, dev->_font_underline_color);
+	lcdEndBatch(dev);
+	return next;
+}
+#endif
+
 int lcdDrawString(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t * ascii, uint16_t color) {
 	int length = strlen((char *)ascii);
 	if(_DEBUG_)printf("lcdDrawString length=%d\n",length);
+#if CONFIG_TEXT_RENDER_LUT
+	bool run = true;
+#elif CONFIG_TEXT_RENDER_CACHE
+	// Opaque text is drawn from the glyph cache
+	bool run = !dev->_font_fill;
+#endif
+#if CONFIG_TEXT_RENDER_CACHE || CONFIG_TEXT_RENDER_LUT
+	if (dev->_font_direction == 0 && run) {
+		int next = lcdDrawTextRun(dev, fx, x, y, ascii, length, color);
+		if (next >= 0) return next;
+	}
+#endif
+	lcdBeginBatch(dev);
 	for(int i=0;i<length;i++) {
 		if(_DEBUG_)printf("ascii[%d]=%x x=%d y=%d\n",i,ascii[i],x,y);
 		if (dev->_font_direction == 0)
@@ -886,6 +2066,7 @@ int lcdDrawString(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t *
 		if (dev->_font_direction == 3)
 			y = lcdDrawChar(dev, fx, x, y, ascii[i], color);
 	}
+	lcdEndBatch(dev);
 	if (dev->_font_direction == 0) return x;
 	if (dev->_font_direction == 2) return x;
 	if (dev->_font_direction == 1) return y;
@@ -901,6 +2082,7 @@ int lcdDrawString(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t *
 // color:color
 int lcdDrawCode(TFT_t * dev, FontxFile *fx, uint16_t x,uint16_t y,uint8_t code,uint16_t color) {
 	if(_DEBUG_)printf("code=%x x=%d y=%d\n",code,x,y);
+	lcdBeginBatch(dev);
 	if (dev->_font_direction == 0)
 		x = lcdDrawChar(dev, fx, x, y, code, color);
 	if (dev->_font_direction == 1)
@@ -909,6 +2091,7 @@ int lcdDrawCode(TFT_t * dev, FontxFile *fx, uint16_t x,uint16_t y,uint8_t code,u
 		x = lcdDrawChar(dev, fx, x, y, code, color);
 	if (dev->_font_direction == 3)
 		y = lcdDrawChar(dev, fx, x, y, code, color);
+	lcdEndBatch(dev);
 	if (dev->_font_direction == 0) return x;
 	if (dev->_font_direction == 2) return x;
 	if (dev->_font_direction == 1) return y;
@@ -1007,16 +2190,19 @@ void lcdBacklightOn(TFT_t * dev) {
 
 // Display Inversion Off
 void lcdInversionOff(TFT_t * dev) {
+	lcdWaitFinish(dev);
 	spi_master_write_command(dev, 0x20); // Display Inversion Off
 }
 
 // Display Inversion On
 void lcdInversionOn(TFT_t * dev) {
+	lcdWaitFinish(dev);
 	spi_master_write_command(dev, 0x21); // Display Inversion On
 }
 
 void lcdWrapArround(TFT_t * dev, SCROLL_TYPE_t scroll, int start, int end) {
 	if (dev->_use_frame_buffer == false) return;
+	if (dev->_band_height != dev->_height) return;
 	
 	int _width = dev->_width;
 	int _height = dev->_height;
@@ -1032,6 +2218,7 @@ void lcdWrapArround(TFT_t * dev, SCROLL_TYPE_t scroll, int start, int end) {
 			dev->_frame_buffer[index1] = dev->_frame_buffer[index2];
 			memcpy((char *)&dev->_frame_buffer[index1+1], (char *)&wk[0], (_width-1)*2);
 		}
+		if (start < end) lcdAddDamage(dev, 0, start, _width-1, end-1);
 	} else if (scroll == SCROLL_LEFT) {
 		uint16_t wk[_width];
 		for (int i=start;i<end;i++) {
@@ -1041,33 +2228,92 @@ void lcdWrapArround(TFT_t * dev, SCROLL_TYPE_t scroll, int start, int end) {
 			dev->_frame_buffer[index2] = dev->_frame_buffer[index1];
 			memcpy((char *)&dev->_frame_buffer[index1], (char *)&wk[1], (_width-1)*2);
 		}
+		if (start < end) lcdAddDamage(dev, 0, start, _width-1, end-1);
 	} else if (scroll == SCROLL_UP) {
-		uint16_t wk;
-		for (int i=start;i<=end;i++) {
-			wk = dev->_frame_buffer[i];
-			for (int j=0;j<_height-1;j++) {
-				index1 = j * _width + i;
-				index2 = (j+1) * _width + i;
-				dev->_frame_buffer[index1] = dev->_frame_buffer[index2];
-			}
-			index2 = (_height-1) * _width + i;
-			dev->_frame_buffer[index2] = wk;
+		// Move the columns row by row so the copies stay sequential
+		if (start > end) return;
+		int size = (end-start+1)*2;
+		uint16_t wk[end-start+1];
+		memcpy((char *)wk, (char *)&dev->_frame_buffer[start], size);
+		for (int j=0;j<_height-1;j++) {
+			index1 = j * _width + start;
+			index2 = (j+1) * _width + start;
+			memcpy((char *)&dev->_frame_buffer[index1], (char *)&dev->_frame_buffer[index2], size);
 		}
+		index2 = (_height-1) * _width + start;
+		memcpy((char *)&dev->_frame_buffer[index2], (char *)wk, size);
+		lcdAddDamage(dev, start, 0, end, _height-1);
 	} else if (scroll == SCROLL_DOWN) {
-		uint16_t wk;
-		for (int i=start;i<=end;i++) {
-			index2 = (_height-1) * _width + i;
-			wk = dev->_frame_buffer[index2];
-			for (int j=_height-2;j>=0;j--) {
-				index1 = j * _width + i;
-				index2 = (j+1) * _width + i;
-				dev->_frame_buffer[index2] = dev->_frame_buffer[index1];
-			}
-			dev->_frame_buffer[i] = wk;
+		if (start > end) return;
+		int size = (end-start+1)*2;
+		uint16_t wk[end-start+1];
+		index2 = (_height-1) * _width + start;
+		memcpy((char *)wk, (char *)&dev->_frame_buffer[index2], size);
+		for (int j=_height-2;j>=0;j--) {
+			index1 = j * _width + start;
+			index2 = (j+1) * _width + start;
+			memcpy((char *)&dev->_frame_buffer[index2], (char *)&dev->_frame_buffer[index1], size);
 		}
+		memcpy((char *)&dev->_frame_buffer[start], (char *)wk, size);
+		lcdAddDamage(dev, start, 0, end, _height-1);
 	}
 }
 
+// Define the hardware scroll area
+// top:First row of the scroll area
+// height:Number of rows in the scroll area. 0 turns scrolling off
+// Rows above and below the area do not move.
+void lcdSetScrollArea(TFT_t * dev, uint16_t top, uint16_t height) {
+	if (height != 0 && dev->_rotation != DIRECTION0) {
+		ESP_LOGW(TAG, "Hardware scroll needs DIRECTION0 rotation");
+		return;
+	}
+	if (top >= dev->_height) return;
+	if (top+height > dev->_height) height = dev->_height - top;
+
+	uint16_t tfa = dev->_offsety + top;
+	uint16_t vsa = height;
+	if (height == 0) {
+		tfa = 0;
+		vsa = GRAM_HEIGHT;
+	}
+	lcdWaitFinish(dev);
+	spi_master_write_command(dev, 0x33);	// Vertical Scrolling Definition
+	spi_master_write_addr(dev, tfa, vsa);
+	spi_master_write_data_word(dev, GRAM_HEIGHT - tfa - vsa);
+	spi_master_write_command(dev, 0x37);	// Vertical Scroll Start Address
+	spi_master_write_data_word(dev, tfa);
+	if (height == 0) {
+		spi_master_write_command(dev, 0x13);	// Normal Display Mode On
+	}
+	dev->_scroll_top = top;
+	dev->_scroll_height = height;
+	dev->_scroll_offset = 0;
+}
+
+// Scroll the scroll area
+// lines:Number of rows to scroll up. Negative values scroll down
+// Only the scroll start address is sent. The rows that scrolled out now show
+// on the other side; draw the new content at lcdScrollRow().
+void lcdScroll(TFT_t * dev, int16_t lines) {
+	if (dev->_scroll_height == 0) return;
+	int offset = (dev->_scroll_offset + lines) % dev->_scroll_height;
+	if (offset < 0) offset += dev->_scroll_height;
+	dev->_scroll_offset = offset;
+
+	// Frames drawn before the scroll must reach the panel first
+	lcdWaitFinish(dev);
+	spi_master_write_command(dev, 0x37);	// Vertical Scroll Start Address
+	spi_master_write_data_word(dev, dev->_offsety + dev->_scroll_top + offset);
+}
+
+// Row to draw at so the pixels show at screen row y
+// Rows outside the scroll area are not moved.
+uint16_t lcdScrollRow(TFT_t * dev, uint16_t y) {
+	if (y < dev->_scroll_top || y >= dev->_scroll_top + dev->_scroll_height) return y;
+	return dev->_scroll_top + (y - dev->_scroll_top + dev->_scroll_offset) % dev->_scroll_height;
+}
+
 // Invert a rectangular area
 // x1:Start X coordinate
 // y1:Start Y coordinate
@@ -1082,13 +2328,14 @@ void lcdInversionArea(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16
 
 	int index = 0;
 	ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
-	if (dev->_use_frame_buffer) {
+	if (dev->_use_frame_buffer && dev->_band_height == dev->_height) {
 		for (int16_t j = y1; j <= y2; j++){
 			for(int16_t i = x1; i <= x2; i++){
-				if (save) save[index++] = dev->_frame_buffer[j*dev->_width+i];
+				if (save) save[index++] = SWAP16(dev->_frame_buffer[j*dev->_width+i]);
 				dev->_frame_buffer[j*dev->_width+i] = ~dev->_frame_buffer[j*dev->_width+i];
 			}
 		}
+		lcdAddDamage(dev, x1, y1, x2, y2);
 	} else {
 		ESP_LOGW(TAG,"To use this feature, enable the FrameBuffer option.");
 	}
@@ -1108,10 +2355,10 @@ void lcdGetRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
 
 	int index = 0;
 	ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
-	if (dev->_use_frame_buffer) {
+	if (dev->_use_frame_buffer && dev->_band_height == dev->_height) {
 		for (int16_t j = y1; j <= y2; j++){
 			for(int16_t i = x1; i <= x2; i++){
-				save[index++] = dev->_frame_buffer[j*dev->_width+i];
+				save[index++] = SWAP16(dev->_frame_buffer[j*dev->_width+i]);
 			}
 		}
 	} else {
@@ -1133,12 +2380,14 @@ void lcdSetRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
 
 	int index = 0;
 	ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
-	if (dev->_use_frame_buffer) {
+	if (dev->_use_frame_buffer && dev->_band_height == dev->_height) {
 		for (int16_t j = y1; j <= y2; j++){
 			for(int16_t i = x1; i <= x2; i++){
-				dev->_frame_buffer[j*dev->_width+i] = save[index++];
+				dev->_frame_buffer[j*dev->_width+i] = SWAP16(save[index]);
+				index++;
 			}
 		}
+		lcdAddDamage(dev, x1, y1, x2, y2);
 	} else {
 		ESP_LOGW(TAG,"Disable frame buffer");
 	}
@@ -1159,26 +2408,190 @@ void lcdResetCursor(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t
 	//lcdDrawCircle(dev, x0, y0, r, color);
 }
 
+// Mark an area of the frame buffer as changed
+// x1:Start X coordinate
+// y1:Start Y coordinate
+// x2:End X coordinate
+// y2:End Y coordinate
+// Only damaged areas are sent by lcdDrawFinish.
+// Areas are merged while the union wastes few pixels, or when the list is full.
+void lcdAddDamage(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	// Only the screen rows held by the frame buffer can be sent
+	if (x2 >= dev->_width) x2 = dev->_width-1;
+	if (y1 < dev->_band_y) y1 = dev->_band_y;
+	if (y2 >= dev->_band_y+dev->_band_height) y2 = dev->_band_y+dev->_band_height-1;
+	if (x1 > x2 || y1 > y2) return;
+
+	for (int i=0;i<dev->_damage_count;i++) {
+		RECT_t *r = &dev->_damage[i];
+		if (x1 >= r->x1 && x2 <= r->x2 && y1 >= r->y1 && y2 <= r->y2) return;
+	}
+
+	while (true) {
+		int best = -1;
+		int32_t best_waste = 0;
+		for (int i=0;i<dev->_damage_count;i++) {
+			RECT_t *r = &dev->_damage[i];
+			uint16_t _x1 = (x1 < r->x1) ? x1 : r->x1;
+			uint16_t _y1 = (y1 < r->y1) ? y1 : r->y1;
+			uint16_t _x2 = (x2 > r->x2) ? x2 : r->x2;
+			uint16_t _y2 = (y2 > r->y2) ? y2 : r->y2;
+			int32_t waste = rectArea(_x1, _y1, _x2, _y2) - rectArea(r->x1, r->y1, r->x2, r->y2) - rectArea(x1, y1, x2, y2);
+			if (best < 0 || waste < best_waste) {
+				best = i;
+				best_waste = waste;
+			}
+		}
+		if (best < 0) break;
+		if (best_waste > DAMAGE_MERGE_SLACK && dev->_damage_count < DAMAGE_RECTS) break;
+
+		// Take the rectangle out of the list and retry with the union
+		RECT_t *r = &dev->_damage[best];
+		if (r->x1 < x1) x1 = r->x1;
+		if (r->y1 < y1) y1 = r->y1;
+		if (r->x2 > x2) x2 = r->x2;
+		if (r->y2 > y2) y2 = r->y2;
+		dev->_damage[best] = dev->_damage[--dev->_damage_count];
+	}
+
+	RECT_t *r = &dev->_damage[dev->_damage_count++];
+	r->x1 = x1;
+	r->y1 = y1;
+	r->x2 = x2;
+	r->y2 = y2;
+}
+
+// Send the damaged areas of a frame buffer to the panel
+static void lcdFlush(TFT_t *dev, uint16_t *buffer, RECT_t *damage, uint16_t damage_count)
+{
+	for (int i=0;i<damage_count;i++) {
+		RECT_t *r = &damage[i];
+		lcdSetWindow(dev, r->x1, r->y1, r->x2, r->y2);
+		if (r->x1 == 0 && r->x2 == dev->_width-1) {
+			// Full rows are contiguous in the frame buffer
+			uint32_t size = rectArea(r->x1, r->y1, r->x2, r->y2);
+			spi_master_queue_pixels(dev, &buffer[r->y1*dev->_width], size);
+		} else {
+#if CONFIG_COLOR_RGB444
+			// Pixel pairs run on from one row to the next
+			PIXEL_STREAM_t stream = {0};
+			for (int y=r->y1;y<=r->y2;y++) {
+				spi_master_stream_pixels(dev, &stream, &buffer[y*dev->_width+r->x1], r->x2-r->x1+1, true);
+			}
+			spi_master_stream_end(dev, &stream);
+#else
+			for (int y=r->y1;y<=r->y2;y++) {
+				spi_master_queue_pixels(dev, &buffer[y*dev->_width+r->x1], r->x2-r->x1+1);
+			}
+#endif
+		}
+	}
+	// The transfers read the frame buffer, wait before it is drawn again
+	spi_master_fence(dev);
+}
+
+#if CONFIG_DOUBLE_BUFFER
+// Send finished frames from the other core
+static void lcdFlushTask(void *arg)
+{
+	TFT_t *dev = arg;
+	while (1) {
+		xSemaphoreTake(dev->_flush_start, portMAX_DELAY);
+		lcdFlush(dev, dev->_flush_buffer, dev->_flush_damage, dev->_flush_damage_count);
+		xSemaphoreGive(dev->_flush_done);
+	}
+}
+#endif
+
 // Draw Frame Buffer
+// Only the damaged areas are sent to the panel.
+// With double buffering the frame is handed to the flush task and drawing
+// continues in the other buffer while it is sent.
 void lcdDrawFinish(TFT_t *dev)
 {
 	if (dev->_use_frame_buffer == false) return;
+	if (dev->_damage_count == 0) return;
+
+	if (dev->_flush_task == NULL) {
+		lcdFlush(dev, dev->_frame_buffer, dev->_damage, dev->_damage_count);
+		dev->_damage_count = 0;
+		return;
+	}
+
+	// Wait until the other buffer has been sent
+	xSemaphoreTake(dev->_flush_done, portMAX_DELAY);
+	uint16_t *buffer = dev->_frame_buffer;
+	uint16_t *next = (buffer == dev->_frame_buffers[0]) ? dev->_frame_buffers[1] : dev->_frame_buffers[0];
+	memcpy(dev->_flush_damage, dev->_damage, sizeof(RECT_t)*dev->_damage_count);
+	dev->_flush_damage_count = dev->_damage_count;
+	dev->_flush_buffer = buffer;
+	xSemaphoreGive(dev->_flush_start);
+
+	// The other buffer holds the previous frame, copy what changed since
+	for (int i=0;i<dev->_damage_count;i++) {
+		RECT_t *r = &dev->_damage[i];
+		size_t size = (r->x2-r->x1+1)*sizeof(uint16_t);
+		for (int y=r->y1;y<=r->y2;y++) {
+			memcpy(&next[y*dev->_width+r->x1], &buffer[y*dev->_width+r->x1], size);
+		}
+	}
+	dev->_frame_buffer = next;
+	dev->_damage_count = 0;
+}
 
-	spi_master_write_command(dev, 0x2A); // set column(x) address
-	spi_master_write_addr(dev, dev->_offsetx, dev->_offsetx+dev->_width-1);
-	spi_master_write_command(dev, 0x2B); // set Page(y) address
-	spi_master_write_addr(dev, dev->_offsety, dev->_offsety+dev->_height-1);
-	spi_master_write_command(dev, 0x2C); // Memory Write
-
-	//uint16_t size = dev->_width*dev->_height;
-	uint32_t size = dev->_width*dev->_height;
-	uint16_t *image = dev->_frame_buffer;
-	while (size > 0) {
-		// 1024 bytes per time.
-		uint16_t bs = (size > 1024) ? 1024 : size;
-		spi_master_write_colors(dev, image, bs);
-		size -= bs;
-		image += bs;
-	}
-	return;
+// Wait until everything drawn so far is on the panel
+void lcdWaitFinish(TFT_t *dev)
+{
+	if (dev->_flush_task != NULL) {
+		xSemaphoreTake(dev->_flush_done, portMAX_DELAY);
+		xSemaphoreGive(dev->_flush_done);
+	}
+	spi_master_fence(dev);
+}
+
+// Draw the screen in horizontal bands
+// draw:Function that draws the whole screen
+// arg:Argument passed to draw
+// draw is called once per band with the drawing functions clipped to that band.
+// While one band is sent by DMA the next one is drawn into the other buffer.
+// Without band buffers draw is called once and draws straight to the panel.
+void lcdDrawBands(TFT_t * dev, DRAW_FUNC_t draw, void *arg)
+{
+	if (dev->_band_buffer[0] == NULL || dev->_use_frame_buffer) {
+		draw(dev, arg);
+		return;
+	}
+
+#if CONFIG_BAND_BUFFER
+	// The band buffers may still be on the wire from the last call
+	spi_master_fence(dev);
+	uint32_t mark[2] = {dev->_trans_count, dev->_trans_count};
+	int index = 0;
+	for (int y=0;y<dev->_height;y+=CONFIG_BAND_HEIGHT) {
+		uint16_t height = dev->_height - y;
+		if (height > CONFIG_BAND_HEIGHT) height = CONFIG_BAND_HEIGHT;
+
+		// Wait until the previous transfer from this buffer is done
+		spi_master_wait_until(dev, mark[index]);
+		dev->_frame_buffer = dev->_band_buffer[index];
+		dev->_band_y = y;
+		dev->_band_height = height;
+		dev->_use_frame_buffer = true;
+		draw(dev, arg);
+		dev->_use_frame_buffer = false;
+
+		uint32_t size = dev->_width * height;
+		lcdSetWindow(dev, 0, y, dev->_width-1, y+height-1);
+		spi_master_queue_pixels(dev, dev->_frame_buffer, size);
+		mark[index] = dev->_trans_count;
+		index ^= 1;
+	}
+
+	dev->_frame_buffer = NULL;
+	dev->_band_y = 0;
+	dev->_band_height = dev->_height;
+	dev->_damage_count = 0;
+	if (!dev->_async) spi_master_fence(dev);
+#endif
 }
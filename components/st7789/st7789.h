@@ -1,10 +1,15 @@
 #ifndef MAIN_ST7789_H_
 #define MAIN_ST7789_H_
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/spi_master.h"
 #include "fontx.h"
 
 #define rgb565(r, g, b) (((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
+// RGB565 between CPU and panel (big-endian) byte order
+#define SWAP16(c) ((uint16_t)(((c) >> 8) | ((c) << 8)))
 
 #define RED    rgb565(255,   0,   0) // 0xf800
 #define GREEN  rgb565(  0, 255,   0) // 0x07e0
@@ -16,6 +21,34 @@
 #define CYAN   rgb565(  0, 156, 209) // 0x04FA
 #define PURPLE rgb565(128,   0, 128) // 0x8010
 
+// Size of the controller memory, the panel shows a window of it
+#define GRAM_WIDTH 240
+#define GRAM_HEIGHT 320
+
+// Transaction ring used by the SPI transport.
+// SPI_QUEUE_SIZE must not exceed the device queue_size given to spi_bus_add_device.
+#define SPI_QUEUE_SIZE 7
+#define SPI_BUFFER_SIZE 2048 // bytes per DMA transaction buffer
+#define SPI_MAX_TRANSFER_SIZE 32768 // bytes per transaction sent straight from a caller buffer
+#define SPI_FILL_BUFFER_SIZE 8192 // bytes of the solid color pattern used by fills
+// Inside lcdBeginBatch/lcdEndBatch transfers up to this size are sent by polling
+#define SPI_POLLING_THRESHOLD 32
+
+// Binary angle units per full circle used by lcdSinQ15/lcdCosQ15
+#define ANGLE_STEPS 1024
+
+// Number of damaged areas remembered between two lcdDrawFinish calls
+#define DAMAGE_RECTS 4
+// Two areas are merged when the union costs at most this many extra pixels
+#define DAMAGE_MERGE_SLACK 64
+
+// Tallest font drawn a line at a time, taller fonts are drawn character by character
+#define TEXT_RUN_HEIGHT 32
+
+// Task that sends the finished frame when double buffering is enabled
+#define FLUSH_TASK_STACK 4096
+#define FLUSH_TASK_PRIORITY 5
+
 typedef enum {DIRECTION0, DIRECTION90, DIRECTION180, DIRECTION270} DIRECTION;
 
 typedef enum {
@@ -25,11 +58,45 @@ typedef enum {
 	SCROLL_UP = 4,
 } SCROLL_TYPE_t;
 
+typedef struct {
+	int16_t x;
+	int16_t y;
+} POINT_t;
+
+typedef struct {
+	uint16_t x1;
+	uint16_t y1;
+	uint16_t x2;
+	uint16_t y2;
+} RECT_t;
+
+// Source pixel formats of lcdBlitImage and lcdDrawMultiPixelsFormat
+typedef enum {
+	PIXEL_RGB565,	// uint16_t in CPU byte order
+	PIXEL_RGB565_BE,	// RGB565 in panel (big-endian) byte order
+	PIXEL_RGB888,	// 3 bytes R, G, B
+	PIXEL_GRAY8,	// 1 byte luminance
+	PIXEL_MONO1,	// 1 bit, MSB first, palette[0] for 0 and palette[1] for 1
+	PIXEL_INDEX8,	// 1 byte index into an RGB565 palette
+} PIXEL_FORMAT_t;
+
+typedef struct {
+	PIXEL_FORMAT_t format;
+	const void *data;
+	uint16_t stride;	// bytes per row
+	const uint16_t *palette;	// RGB565 colors for PIXEL_MONO1 and PIXEL_INDEX8
+} IMAGE_t;
+
 typedef struct {
 	uint16_t _width;
 	uint16_t _height;
 	uint16_t _offsetx;
 	uint16_t _offsety;
+	uint16_t _rotation;
+	uint16_t _panel_width;
+	uint16_t _panel_height;
+	uint16_t _panel_offsetx;
+	uint16_t _panel_offsety;
 	uint16_t _font_direction;
 	uint16_t _font_fill;
 	uint16_t _font_fill_color;
@@ -38,10 +105,48 @@ typedef struct {
 	int16_t _dc;
 	int16_t _bl;
 	spi_device_handle_t _SPIHandle;
+	spi_transaction_t _trans[SPI_QUEUE_SIZE];
+	uint8_t *_trans_buffer[SPI_QUEUE_SIZE];
+	uint16_t _trans_head;
+	uint16_t _trans_pending;
+	bool _async;
+	uint16_t _batch;
+	uint16_t _polling_threshold;
+	uint32_t _trans_count;
+	uint32_t _trans_done;
+	uint32_t _byte_count;
+	uint8_t *_fill_buffer;
+	uint16_t _fill_color;
+	uint32_t _fill_length;
+	uint32_t _fill_mark;
+	bool _window_valid;
+	uint16_t _window_x1;
+	uint16_t _window_y1;
+	uint16_t _window_x2;
+	uint16_t _window_y2;
 	bool _use_frame_buffer;
 	uint16_t *_frame_buffer;
+	uint16_t _band_y;
+	uint16_t _band_height;
+	uint16_t *_band_buffer[2];
+	uint8_t *_text_run;
+	uint16_t _text_run_size;
+	uint16_t _scroll_top;
+	uint16_t _scroll_height;
+	uint16_t _scroll_offset;
+	RECT_t _damage[DAMAGE_RECTS];
+	uint16_t _damage_count;
+	uint16_t *_frame_buffers[2];
+	uint16_t *_flush_buffer;
+	RECT_t _flush_damage[DAMAGE_RECTS];
+	uint16_t _flush_damage_count;
+	TaskHandle_t _flush_task;
+	SemaphoreHandle_t _flush_start;
+	SemaphoreHandle_t _flush_done;
 } TFT_t;
 
+typedef void (*DRAW_FUNC_t)(TFT_t * dev, void *arg);
+
 void spi_clock_speed(int speed);
 void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO_RESET, int16_t GPIO_BL);
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength);
@@ -51,11 +156,21 @@ bool spi_master_write_data_word(TFT_t * dev, uint16_t data);
 bool spi_master_write_addr(TFT_t * dev, uint16_t addr1, uint16_t addr2);
 bool spi_master_write_color(TFT_t * dev, uint16_t color, uint16_t size);
 bool spi_master_write_colors(TFT_t * dev, uint16_t * colors, uint16_t size);
+void spi_master_set_async(TFT_t * dev, bool enable);
+void spi_master_fence(TFT_t * dev);
+void lcdBeginBatch(TFT_t * dev);
+void lcdEndBatch(TFT_t * dev);
 
 void delayMS(int ms);
 void lcdInit(TFT_t * dev, int width, int height, int offsetx, int offsety);
+void lcdSetWindow(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+void lcdSetRotation(TFT_t * dev, DIRECTION rotation);
 void lcdDrawPixel(TFT_t * dev, uint16_t x, uint16_t y, uint16_t color);
 void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint16_t * colors);
+void lcdBlitImage(TFT_t * dev, int16_t x, int16_t y, const IMAGE_t *image, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h);
+void lcdDrawMultiPixelsFormat(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, const void *pixels, PIXEL_FORMAT_t format, const uint16_t *palette);
+void lcdBlit(TFT_t * dev, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h);
+void lcdBlitKey(TFT_t * dev, int16_t x, int16_t y, const uint16_t *image, uint16_t stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h, uint16_t key);
 void lcdDrawFillRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
 void lcdDrawFillSquare(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t size, uint16_t color);
 void lcdDisplayOff(TFT_t * dev);
@@ -63,12 +178,17 @@ void lcdDisplayOn(TFT_t * dev);
 void lcdFillScreen(TFT_t * dev, uint16_t color);
 void lcdDrawLine(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
 void lcdDrawRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
+int16_t lcdSinQ15(uint16_t angle);
+int16_t lcdCosQ15(uint16_t angle);
 void lcdDrawRectAngle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color);
 void lcdDrawTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color);
+void lcdDrawFillTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color);
+void lcdDrawFillPolygon(TFT_t * dev, const POINT_t *points, uint16_t n, uint16_t color);
 void lcdDrawRegularPolygon(TFT_t *dev, uint16_t xc, uint16_t yc, uint16_t n, uint16_t r, uint16_t angle, uint16_t color);
 void lcdDrawCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color);
 void lcdDrawFillCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color);
 void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t r, uint16_t color);
+void lcdDrawFillRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t r, uint16_t color);
 void lcdDrawArrow(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t w, uint16_t color);
 void lcdDrawFillArrow(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t w, uint16_t color);
 int lcdDrawChar(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t ascii, uint16_t color);
@@ -86,11 +206,17 @@ void lcdBacklightOn(TFT_t * dev);
 void lcdInversionOff(TFT_t * dev);
 void lcdInversionOn(TFT_t * dev);
 void lcdWrapArround(TFT_t * dev, SCROLL_TYPE_t scroll, int start, int end);
+void lcdSetScrollArea(TFT_t * dev, uint16_t top, uint16_t height);
+void lcdScroll(TFT_t * dev, int16_t lines);
+uint16_t lcdScrollRow(TFT_t * dev, uint16_t y);
 void lcdInversionArea(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t *save);
 void lcdGetRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t *save);
 void lcdSetRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t *save);
 void lcdSetCursor(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color, uint16_t *save);
 void lcdResetCursor(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color, uint16_t *save);
+void lcdAddDamage(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
 void lcdDrawFinish(TFT_t *dev);
+void lcdWaitFinish(TFT_t *dev);
+void lcdDrawBands(TFT_t * dev, DRAW_FUNC_t draw, void *arg);
 #endif /* MAIN_ST7789_H_ */
 
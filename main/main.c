@@ -243,8 +243,29 @@ void action_buttons(button_state_t bs)
     }
 }
 
+static void spiffs_init()
+{
+    ESP_LOGI(TAG, "Initializing SPIFFS");
+    // Maximum files that could be open at the same time is 7.
+    ESP_ERROR_CHECK(mountSPIFFS("/fonts", "storage1", 7));
+    listSPIFFS("/fonts/");
+}
+
 void app_main(void)
 {
+#if !CONFIG_FONTX_EMBEDDED
+    // the first page reads its font from SPIFFS
+    spiffs_init();
+#endif
+    // pages init
+    pages_init();
+    // optional drawing benchmark (needs the 16 dot font)
+    pages_benchmark();
+    // set timer to turn screen off
+    screen_off_timer = xTimerCreate("screen_off_timer", pdMS_TO_TICKS(60000), pdTRUE, NULL, screen_off_timer_callback);
+    xTimerStart(screen_off_timer, 0);
+    // draw the home page before NVS, wifi and SPIFFS are set up
+    page_set(PAGE_HOME);
     // Initialize NVS
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -255,22 +276,15 @@ void app_main(void)
     ESP_ERROR_CHECK(ret);
     // wifi init
     wifi_init();
-    // pages init
-    pages_init();
-    // setup SPIFFS
-    ESP_LOGI(TAG, "Initializing SPIFFS");
-    // Maximum files that could be open at the same time is 7.
-    ESP_ERROR_CHECK(mountSPIFFS("/fonts", "storage1", 7));
-    listSPIFFS("/fonts/");
+#if CONFIG_FONTX_EMBEDDED
+    // the other fonts are read from SPIFFS when the font partition lacks them
+    spiffs_init();
+#endif
     // init buttons
     ESP_LOGI(TAG, "Initializing buttons");
     button_init();
-    // set timer to turn screen off
-    screen_off_timer = xTimerCreate("screen_off_timer", pdMS_TO_TICKS(60000), pdTRUE, NULL, screen_off_timer_callback);
-    xTimerStart(screen_off_timer, 0);
     // start main loop
     ESP_LOGI(TAG, "Application main loop started");
-    page_set(PAGE_HOME);
     while (1)
     {
         action_buttons(button_state());
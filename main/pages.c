@@ -1,7 +1,13 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 
 #include "st7789.h"
 #include "fontx.h"
+#include "displaylist.h"
+#include "displayserver.h"
+#include "fontstore.h"
+#include "benchmark.h"
 
 #include "wifi.h"
 #include "http.h"
@@ -27,6 +33,20 @@ FontxFile fx24G[2];
 FontxFile fx32G[2];
 FontxFile fx32L[2];
 
+#if CONFIG_FONTX_EMBEDDED
+// linked into the app by the top-level CMakeLists.txt
+extern const uint8_t ilgh16xb_start[] asm("_binary_ILGH16XB_FNT_start");
+extern const uint8_t ilgh16xb_end[] asm("_binary_ILGH16XB_FNT_end");
+#endif
+
+// draw ops of the current page
+static DISPLAY_LIST_t page_list;
+
+#if CONFIG_DISPLAY_SERVER
+// owns dev once started, pages are posted to it
+static DISPLAY_SERVER_t server;
+#endif
+
 static ap_brief_t ap_list[10];
 static uint16_t ap_count = 0;
 static uint16_t cursor = 0;
@@ -42,29 +62,63 @@ struct pos_t
     uint16_t y;
 };
 
+// use a font from the font partition, or the SPIFFS file when it is not there
+static void font_init(FontxFile *fx, const char *name, const char *path)
+{
+#if CONFIG_FONTX_STORE
+    if (InitFontxStore(fx, name))
+    {
+        return;
+    }
+#endif
+    InitFontx(fx, path, "");
+}
+
 esp_err_t pages_init()
 {
     ESP_LOGI(TAG, "Initializing fonts");
-    InitFontx(fx16G, "/fonts/ILGH16XB.FNT", ""); // 8x16Dot Gothic
-    InitFontx(fx24G, "/fonts/ILGH24XB.FNT", ""); // 12x24Dot Gothic
-    InitFontx(fx32G, "/fonts/ILGH32XB.FNT", ""); // 16x32Dot Gothic
-    InitFontx(fx32L, "/fonts/LATIN32B.FNT", ""); // 16x32Dot Latin
+#if CONFIG_FONTX_STORE
+    OpenFontxStore("fonts");
+#endif
+#if CONFIG_FONTX_EMBEDDED
+    InitFontxMemory(fx16G, "ILGH16XB.FNT", ilgh16xb_start, ilgh16xb_end - ilgh16xb_start); // 8x16Dot Gothic
+#else
+    font_init(fx16G, "ILGH16XB.FNT", "/fonts/ILGH16XB.FNT"); // 8x16Dot Gothic
+#endif
+    font_init(fx24G, "ILGH24XB.FNT", "/fonts/ILGH24XB.FNT"); // 12x24Dot Gothic
+    font_init(fx32G, "ILGH32XB.FNT", "/fonts/ILGH32XB.FNT"); // 16x32Dot Gothic
+    font_init(fx32L, "LATIN32B.FNT", "/fonts/LATIN32B.FNT"); // 16x32Dot Latin
     ESP_LOGI(TAG, "Initializing ST7789 display");
     spi_master_init(&dev, CONFIG_MOSI_GPIO, CONFIG_SCLK_GPIO, CONFIG_CS_GPIO, CONFIG_DC_GPIO, CONFIG_RESET_GPIO, CONFIG_BL_GPIO);
     lcdInit(&dev, CONFIG_WIDTH, CONFIG_HEIGHT, CONFIG_OFFSETX, CONFIG_OFFSETY);
+    // queue SPI transfers so drawing overlaps with the previous transfer
+    spi_master_set_async(&dev, true);
+#if CONFIG_DISPLAY_SERVER
+    // the benchmark still draws directly, nothing is posted before the first page
+    dsStart(&server, &dev);
+#endif
+    return ESP_OK;
+}
+
+esp_err_t pages_benchmark()
+{
+#if CONFIG_DRAW_BENCHMARK
+    ESP_LOGI(TAG, "Running drawing benchmark");
+    lcdBenchmark(&dev, fx16G);
+#endif
     return ESP_OK;
 }
 
 void drawCmdStr(FontxFile *fx, char *str, uint16_t x, uint16_t y)
 {
-    lcdSetFontUnderLine(&dev, BLUE);
-    lcdDrawString(&dev, fx, x, y, (uint8_t *)str, BLUE);
-    lcdUnsetFontUnderLine(&dev);
+    dlSetFontUnderLine(&page_list, BLUE);
+    dlDrawString(&page_list, fx, x, y, (uint8_t *)str, BLUE);
+    dlUnsetFontUnderLine(&page_list);
 }
 
 void drawCursor(uint16_t xc, uint16_t yc, uint16_t w, uint16_t h)
 {
-    lcdDrawTriangle(&dev, xc, yc, w, h, 90, RED);
+    dlDrawFillTriangle(&page_list, xc, yc, w, h, 90, RED);
 }
 
 struct pos_t drawStrWrap(FontxFile *fx, uint16_t fontWidth, uint16_t fontHeight, char *str, uint16_t x, uint16_t y, uint16_t maxWidth, uint16_t color)
@@ -79,7 +133,7 @@ struct pos_t drawStrWrap(FontxFile *fx, uint16_t fontWidth, uint16_t fontHeight,
         uint16_t charsRemainingWidth = charsRemaining * fontWidth;
         if (charsRemainingWidth <= maxWidth)
         {
-            lcdDrawString(&dev, fx, x, yPos, (uint8_t *)&str[drawnChars], color);
+            dlDrawString(&page_list, fx, x, yPos, (uint8_t *)&str[drawnChars], color);
             drawnChars += charsRemaining;
             xPos = x + charsRemainingWidth;
         }
@@ -89,7 +143,7 @@ struct pos_t drawStrWrap(FontxFile *fx, uint16_t fontWidth, uint16_t fontHeight,
             char buf[drawLen];
             strncpy(buf, &str[drawnChars], drawLen);
             buf[drawLen] = '\0';
-            lcdDrawString(&dev, fx, x, yPos, (uint8_t *)buf, color);
+            dlDrawString(&page_list, fx, x, yPos, (uint8_t *)buf, color);
             drawnChars += drawLen;
             xPos = x + drawLen * fontWidth;
         }
@@ -108,23 +162,23 @@ esp_err_t page_init(enum page_id id)
     return ESP_OK;
 }
 
-esp_err_t page_display(enum page_id id)
+// Record the draw ops of a page into page_list
+static void page_record(enum page_id id)
 {
-    esp_err_t err;
     // get font width & height
     FontxFile *fx = fx16G;
     uint8_t fontWidth;
     uint8_t fontHeight;
-    GetFontx(fx, 0, &fontWidth, &fontHeight);
+    GetFontxSize(fx, &fontWidth, &fontHeight);
 
     // set font direction
-    lcdSetFontDirection(&dev, 0);
+    dlSetFontDirection(&page_list, 0);
 
     switch (id)
     {
     case PAGE_HOME:
         ESP_LOGI(TAG, "Displaying home page");
-        lcdFillScreen(&dev, WHITE);
+        dlFillScreen(&page_list, WHITE);
         // draw text
         drawCmdStr(fx, "Press button to", fontHeight / 2, fontHeight * 2 - 1);
         drawCmdStr(fx, "scan wifi", fontHeight / 2, fontHeight * 3 - 1);
@@ -132,31 +186,24 @@ esp_err_t page_display(enum page_id id)
     case PAGE_WIFI_SCAN:
         ESP_LOGI(TAG, "Displaying WiFi scan page");
         // show scanning screen
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Scanning WiFi...", BLACK);
-        // scan wifi
-        ap_count = 0;
-        err = wifi_scan(ap_list, 10, &ap_count);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Failed to scan WiFi networks");
-            return err;
-        }
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Scanning WiFi...", BLACK);
         break;
     case PAGE_WIFI_SCAN_FAIL:
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Failed to scan", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 20, fontHeight * 3 - 1, (unsigned char *)"WiFi networks", BLACK);
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Failed to scan", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 20, fontHeight * 3 - 1, (unsigned char *)"WiFi networks", BLACK);
         break;
     case PAGE_WIFI_LIST:
         // display wifi list
-        lcdFillScreen(&dev, WHITE);
+        dlFillScreen(&page_list, WHITE);
         for (int i = 0; i < ap_count; i++)
         {
             if (cursor == i)
             {
                 drawCursor(fontHeight / 2, fontHeight / 2 + (fontHeight * (i + 1) - 1), fontHeight - 4, fontHeight - 4);
             }
-            lcdDrawString(&dev, fx, fontHeight, fontHeight * (i + 2) - 1, (unsigned char *)ap_list[i].ssid, BLACK);
+            dlDrawString(&page_list, fx, fontHeight, fontHeight * (i + 2) - 1, (unsigned char *)ap_list[i].ssid, BLACK);
         }
         int exitTextHeight = fontHeight * (ap_count + 3) - 1;
         if (cursor >= ap_count)
@@ -167,9 +214,9 @@ esp_err_t page_display(enum page_id id)
         break;
     case PAGE_WIFI_ENTER_PASSWORD:
         // Display WiFi password entry page
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Enter WiFi", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"Password:", BLACK);
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Enter WiFi", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"Password:", BLACK);
         // show current entered password
         struct pos_t pos = {fontHeight / 2, fontHeight * 5 - 1};
         if (user_entry[0] != '\0')
@@ -183,26 +230,94 @@ esp_err_t page_display(enum page_id id)
         // show next character to be entered
         if (next_char <= 126)
         {
-            lcdDrawString(&dev, fx, pos.x, pos.y - fontHeight, (unsigned char *)&next_char, BLACK);
+            dlDrawString(&page_list, fx, pos.x, pos.y - fontHeight, (unsigned char *)&next_char, BLACK);
         }
         if (next_char == 127)
         {
-            lcdDrawString(&dev, fx, pos.x + fontWidth, pos.y - fontHeight, (unsigned char *)"<-", RED);
+            dlDrawString(&page_list, fx, pos.x + fontWidth, pos.y - fontHeight, (unsigned char *)"<-", RED);
         }
         else if (next_char == 128)
         {
-            lcdDrawString(&dev, fx, pos.x + fontWidth, pos.y - fontHeight, (unsigned char *)"->", RED);
+            dlDrawString(&page_list, fx, pos.x + fontWidth, pos.y - fontHeight, (unsigned char *)"->", RED);
         }
         else
         {
             // draw input box
-            lcdDrawRect(&dev, pos.x, pos.y - fontHeight * 2, pos.x + fontWidth, pos.y - fontHeight, RED);
+            dlDrawRect(&page_list, pos.x, pos.y - fontHeight * 2, pos.x + fontWidth, pos.y - fontHeight, RED);
+        }
+        break;
+    case PAGE_WIFI_CONNECT:
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Connecting to", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"WiFi...", BLACK);
+        break;
+    case PAGE_WIFI_CONNECT_FAIL:
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Failed to", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"connect to WiFi", BLACK);
+        break;
+    case PAGE_WIFI_CONNECTED:
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"WiFi Connected!", BLACK);
+        break;
+    case PAGE_BLOCKHEIGHT_LOAD:
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Loading", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Blockheight...", BLACK);
+        break;
+    case PAGE_BLOCKHEIGHT:
+        dlFillScreen(&page_list, WHITE);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Blockheight:", BLACK);
+        dlDrawString(&page_list, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"0", BLACK);
+        break;
+    default:
+        break;
+    }
+}
+
+
+esp_err_t page_display(enum page_id id)
+{
+    esp_err_t err;
+
+    if (id <= PAGE_NONE || id > PAGE_BLOCKHEIGHT)
+    {
+        ESP_LOGE(TAG, "PD: Unknown page ID: %d", id);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // record the page, then draw it in bands when band buffers are enabled
+    dlBegin(&page_list, &dev);
+    page_record(id);
+#if CONFIG_DISPLAY_SERVER
+    // the ops are copied, retry while the queue holds other updates
+    while ((err = dsSubmit(&server, &page_list)) == ESP_ERR_NO_MEM)
+    {
+        vTaskDelay(1);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "PD: Page %d not drawn: %s", id, esp_err_to_name(err));
+        return err;
+    }
+#else
+    lcdDrawBands(&dev, dlDraw, &page_list);
+    lcdDrawFinish(&dev);
+#endif
+
+    switch (id)
+    {
+    case PAGE_WIFI_SCAN:
+        // scan wifi
+        ap_count = 0;
+        err = wifi_scan(ap_list, 10, &ap_count);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to scan WiFi networks");
+            return err;
         }
         break;
     case PAGE_WIFI_CONNECT:
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Connecting to", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"WiFi...", BLACK);
         // connect wifi
         err = wifi_connect(selected_ap.ssid, user_entry);
         if (err != ESP_OK)
@@ -211,19 +326,7 @@ esp_err_t page_display(enum page_id id)
             return err;
         }
         break;
-    case PAGE_WIFI_CONNECT_FAIL:
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Failed to", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"connect to WiFi", BLACK);
-        break;
-    case PAGE_WIFI_CONNECTED:
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"WiFi Connected!", BLACK);
-        break;
     case PAGE_BLOCKHEIGHT_LOAD:
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Loading", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Blockheight...", BLACK);
         // load blockheight
         char* pem = "-----BEGIN CERTIFICATE-----\n"
 "MIIHXTCCBkWgAwIBAgIQDLRi7sXtOj+bsANd8R2bsjANBgkqhkiG9w0BAQsFADBZ\n"
@@ -269,16 +372,9 @@ esp_err_t page_display(enum page_id id)
 "-----END CERTIFICATE-----";
         http_get_url("https://blockchain.info/q/getblockcount", pem);
         break;
-    case PAGE_BLOCKHEIGHT:
-        lcdFillScreen(&dev, WHITE);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 2 - 1, (unsigned char *)"Blockheight:", BLACK);
-        lcdDrawString(&dev, fx, fontHeight / 2, fontHeight * 3 - 1, (unsigned char *)"0", BLACK);
-        break;
     default:
-        ESP_LOGE(TAG, "PD: Unknown page ID: %d", id);
-        return ESP_ERR_INVALID_ARG;
+        break;
     }
-    lcdDrawFinish(&dev);
     return ESP_OK;
 }
 
@@ -416,18 +512,41 @@ void page_down(enum page_id id)
     }
 }
 
+static void screen_off(TFT_t *dev, void *arg)
+{
+    lcdBacklightOff(dev);
+    lcdDisplayOff(dev);
+}
+
+static void screen_on(TFT_t *dev, void *arg)
+{
+    lcdBacklightOn(dev);
+    lcdDisplayOn(dev);
+}
+
+// run f on the task that owns the display
+static esp_err_t screen_call(DRAW_FUNC_t f)
+{
+#if CONFIG_DISPLAY_SERVER
+    if (!dsCall(&server, f, NULL))
+    {
+        ESP_LOGE(TAG, "Display server queue full");
+        return ESP_ERR_NO_MEM;
+    }
+#else
+    f(&dev, NULL);
+#endif
+    return ESP_OK;
+}
+
 esp_err_t screen_turn_off()
 {
     ESP_LOGI(TAG, "Turning screen off");
-    lcdBacklightOff(&dev);
-    lcdDisplayOff(&dev);
-    return ESP_OK;
+    return screen_call(screen_off);
 }
 
 esp_err_t screen_turn_on()
 {
     ESP_LOGI(TAG, "Turning screen on");
-    lcdBacklightOn(&dev);
-    lcdDisplayOn(&dev);
-    return ESP_OK;
+    return screen_call(screen_on);
 }
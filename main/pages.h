@@ -27,6 +27,7 @@ enum page_action_t
 };
 
 esp_err_t pages_init();
+esp_err_t pages_benchmark();
 esp_err_t page_init(enum page_id id);
 esp_err_t page_display(enum page_id id);
 enum page_action_t page_action(enum page_id id);